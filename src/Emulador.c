@@ -9,33 +9,45 @@
  * Modificação: 04/06/2024
  **/
 
+// As flags abaixo marcadas com uma opção de linha de comando são apenas o valor padrão dessa opção,
+// que pode ser alterado em tempo de execução sem recompilar o emulador.
+
 // Se configurado como 1, desativa todos os recursos interativos do emulador e o coloca em um modo
-// de "apenas execução". Esse modo é usado em testes automatizados. 
+// de "apenas execução". Esse modo é usado em testes automatizados. Opção --dummy.
 #define DUMMY_MODE 0
 
 // Configura se cores serão usadas ou não no console. Desative se estiver tendo problemas com
 // terminais que não suportam escapes ANSI apropriadamente
 #define ENABLE_COLORS 1
 
-// Se habilitado, interrompe o emulador logo antes de executar a primeira instrução
+// Se habilitado, interrompe o emulador logo antes de executar a primeira instrução.
+// Opção --no-break-at-start.
 #define START_IN_BREAKING_MODE 1
 
 // Quando habilitado, intercepta CTRL-C para interromper a execução do emulador
 #define INSTALL_SIGINT_HANDLER 1
 
-// Se habilitado, por padrão interromperá a execução quando houver uma fault
+// Se habilitado, por padrão interromperá a execução quando houver uma fault.
+// Opção --no-break-at-faults.
 #define BREAK_AT_FAULTS 1
 
-// Se habilitado, antes de terminar a execução do programa, interrompe uma última vez o depurador
+// Se habilitado, antes de terminar a execução do programa, interrompe uma última vez o depurador.
+// Opção --no-break-at-halt.
 #define BREAK_AT_HALT 1
 
 // Configura se a notação extendida ou padrão será usada nos disassemblies
 #define DEFAULT_EXTENDED_NOTATION 1
 
-// Configura se a ocorrência de loop-around na memória gera uma fault ou apenas um aviso
+// Configura se a ocorrência de loop-around na memória gera uma fault ou apenas um aviso.
+// Opção --allow-wrap.
 #define FAULT_ON_LOOP_AROUND 1
 
+// Habilita as funções POSIX (clock_gettime) mesmo compilando com -std=c99, e MAP_ANONYMOUS
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "driverEP1.h"
+#include "emulTrace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -45,6 +57,15 @@
 #include <signal.h>
 #include <ctype.h>
 #include <time.h>
+#include <stddef.h>
+#include <limits.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
 // -- Sequências de escape para as cores no console
 #if ENABLE_COLORS
@@ -101,13 +122,6 @@ typedef enum {
 	ARIT_SUB  = 0b111
 } AritOp;
 
-/// @brief Vetor dinâmico de inteiros
-typedef struct VectorT {
-	void** array;
-	int size;
-	int capacity;
-} Vector;
-
 // Definição dos registradores do processador
 typedef struct {
 	uint16_t RI;
@@ -120,33 +134,266 @@ typedef struct {
 	uint16_t PSW;
 } Registers;
 
-/// @brief Estrutura de um breakpoint na memória. Possui um endereço e um máximo de hits.
-typedef struct BreakpointT {
-	uint16_t address;
-	int hits;
-} Breakpoint;
+// Resultados possíveis da execução de uma instrução. EMU_LOOP indica que o detector de laços
+// encontrou uma repetição do estado da máquina e o programa nunca vai terminar. EMU_BREAK indica que
+// a instrução executou e disparou um watchpoint.
+typedef enum {
+	EMU_OK, EMU_HALT, EMU_FAULT, EMU_LOOP, EMU_BREAK
+} EmuResult;
+
+typedef struct DecodedT Decoded;
+
+/// @brief Função que executa uma instrução já pré-decodificada
+typedef EmuResult (*ExecHandler)(const Decoded* decoded);
+
+/// @brief Instrução pré-decodificada. Cada posição da memória tem uma dessas entradas associada,
+/// contendo a função que executa a instrução com os operandos já resolvidos.
+struct DecodedT {
+	ExecHandler handler;
+	const void* target;
+	uint16_t argument;
+	uint16_t instruction;
+
+	// Argumento da última instrução de uma superinstrução (destino do STA ou do JNZ)
+	uint16_t fusedArgument;
+
+	// Número de instruções executadas pela entrada. Maior que 1 em superinstruções, que cobrem
+	// também as palavras seguintes da memória.
+	uint8_t length;
+
+	// Em um JNZ que fecha um laço contado, número de instruções por iteração do laço (0 se não)
+	uint8_t loopLength;
+};
+
+// Superinstruções: sequências comuns de instruções executadas por uma única entrada pré-decodificada
+typedef enum {
+	FUSION_LDA_ARIT_STA, FUSION_SUB_JNZ, FUSION_COUNT
+} Fusion;
+
+// Maior número de instruções cobertas por uma superinstrução
+#define FUSION_MAX_LENGTH 3
+
+/// @brief Flags da PSW ainda não calculadas. As ARITs pré-decodificadas apenas registram aqui seus
+/// operandos e resultados estendidos. A PSW só é atualizada por emuSyncFlags() quando for lida.
+typedef struct {
+	// Diferença com sinal op1 - op2 da última ARIT, que define LE, EQ e GR
+	int32_t cmp;
+
+	// Soma estendida do último ADD (OV) e diferença com sinal do último SUB (UN)
+	uint32_t sum;
+	int32_t diff;
+
+	bool cmpPending;
+	bool ovPending;
+	bool unPending;
+} LazyFlags;
+
+// Operações do bytecode das expressões de breakpoints condicionais e tracepoints. A expressão é
+// avaliada em uma pilha: operandos empilham um valor e operadores consomem os do topo.
+typedef enum {
+	// Operandos: constante, registrador (deslocamento em Registers), bit da PSW, número de vezes que
+	// o endereço foi alcançado e leitura da memória no endereço do topo da pilha
+	EXPR_CONST, EXPR_REG, EXPR_FLAG, EXPR_HITS, EXPR_MEM,
+
+	// Operadores unários
+	EXPR_NOT, EXPR_BNOT, EXPR_NEG,
+
+	// Operadores binários
+	EXPR_ADD, EXPR_SUB, EXPR_BAND, EXPR_BOR, EXPR_BXOR,
+	EXPR_EQ, EXPR_NE, EXPR_LT, EXPR_LE, EXPR_GT, EXPR_GE, EXPR_LAND, EXPR_LOR
+} ExprOpcode;
+
+/// @brief Instrução do bytecode de uma expressão
+typedef struct {
+	uint8_t op;
+	int32_t operand;
+} ExprOp;
+
+/// @brief Expressão compilada. Uma expressão vazia (length 0) é sempre verdadeira.
+typedef struct {
+	ExprOp* code;
+	int length;
+
+	// Se a expressão lê a PSW, que precisa ser sincronizada antes da avaliação
+	bool readsFlags;
+} Expr;
+
+// Profundidade máxima da pilha de avaliação de uma expressão
+#define EXPR_MAX_DEPTH 16
+
+/// @brief Condição de um breakpoint condicional ou tracepoint. Breakpoints condicionais só param a
+/// execução quando a condição é verdadeira; tracepoints nunca param e apenas imprimem a expressão.
+typedef struct {
+	Expr condition;
+
+	// Expressão impressa pelo tracepoint e o seu texto (NULL em breakpoints condicionais)
+	Expr trace;
+	char* traceText;
+
+	// Número de vezes que a execução chegou no endereço, lido por HITS nas expressões
+	uint32_t reached;
+} BreakCondition;
 
 /// @brief Definição da estrutura do emulador
 typedef struct {
 	Registers* registers;
 	uint16_t* memory;
+	Decoded* decoded;
 	uint16_t* snapshot;
 	int memorySize;
 	bool breaking;
 	int stepsLeft;
 	bool breakOnFaults;
-	Vector breakpoints;
+
+	// Breakpoints: bitmap dos endereços com breakpoint ativo (hits != 0), tabela densa com os hits
+	// restantes de cada endereço (BREAKPOINT_NONE onde não há breakpoint) e número de ativos
+	uint64_t* breakpointBits;
+	int* breakpointHits;
+	int activeBreakpoints;
+
+	// Condições dos breakpoints condicionais e tracepoints de cada endereço (NULL se não houver).
+	// breakpointConfirmed indica que um núcleo já avaliou como verdadeira a condição do breakpoint
+	// em que parou, para que ela não seja avaliada de novo.
+	BreakCondition** breakpointConditions;
+	bool breakpointConfirmed;
+
+	// A instrução atual foi alcançada voltando no tempo ou restaurando um estado salvo. O breakpoint
+	// nela não é contado de novo.
+	bool rewound;
+
+	// Watchpoints: bitmap dos endereços com watchpoint armado, indexado por todo o espaço de
+	// endereçamento de LDA e STA, tipos de acesso observados (bits WATCH_*) e hits restantes
+	// (BREAKPOINT_NONE onde não há watchpoint) de cada endereço e número de armados
+	uint64_t* watchBits;
+	uint8_t* watchKinds;
+	int* watchHits;
+	int activeWatchpoints;
+
+	uint64_t instructionCount;
+	LazyFlags lazyFlags;
+
+	// Número de execuções de cada tipo de superinstrução
+	uint64_t fusionCounts[FUSION_COUNT];
+
+	// Mapa paralelo à memória indicando as palavras que são código já decodificado ou traduzido
+	// pelo JIT (bits CODE_*). Um STA sobre uma dessas palavras precisa invalidá-la.
+	uint8_t* codeMap;
 } Emul;
 
-// Guias de controle da interface de usuário
+// Valor de breakpointHits nos endereços sem breakpoint
+#define BREAKPOINT_NONE INT_MIN
+
+// Tamanho do espaço endereçável pelo argumento de 12 bits das instruções
+#define ADDRESS_SPACE 0x1000
+
+// Tipos de acesso observados por um watchpoint: leitura (LDA), escrita (STA) e escrita que muda o
+// valor da palavra
+#define WATCH_READ   0x1
+#define WATCH_WRITE  0x2
+#define WATCH_CHANGE 0x4
+
+#define CODE_DECODED 0x1
+#define CODE_JIT     0x2
+#define CODE_LOOP    0x4
+
+
+/// @brief Impressão digital do estado da máquina usada pelo detector de laços. O RI fica de fora, pois
+/// é determinado pelo PC e pela memória.
+typedef struct {
+	uint16_t PC, A, B, C, D, R, PSW;
+	uint64_t memoryHash;
+} Fingerprint;
+
+// Como as mensagens do núcleo chegam ao terminal: impressas pelo próprio núcleo (UI_SYNC), ou por
+// uma thread de interface, esperando por espaço na fila (UI_BLOCK) ou descartando (UI_DROP) quando
+// ela está cheia
 typedef enum {
-	CLI_DO_NOTHING, CLI_DO_RESET, CLI_DO_QUIT
-} CliControl;
+	UI_SYNC, UI_BLOCK, UI_DROP
+} UiPolicy;
 
-// Resultados possíveis da execução de uma instrução
+// Núcleos de execução disponíveis para a execução livre do programa
 typedef enum {
-	EMU_OK, EMU_HALT, EMU_FAULT
-} EmuResult;
+	CORE_SWITCH, CORE_THREADED, CORE_JIT
+} Core;
+
+/// @brief Opções de execução do emulador configuráveis pela linha de comando
+typedef struct {
+	// Executa sem interface, sem trace e sem depurador. Ao final imprime apenas o estado dos
+	// registradores, o número de instruções executadas e o tempo decorrido.
+	bool headless;
+
+	// Núcleo usado quando o emulador executa livremente, fora do modo step-through
+	Core core;
+
+	// Se definido, em vez de executar o programa gera nesse arquivo um programa C equivalente
+	const char* aotOutput;
+
+	// Agrupa sequências comuns de instruções em superinstruções durante a pré-decodificação
+	bool fusion;
+
+	// No modo headless, interrompe a execução quando o estado da máquina se repete
+	bool detectLoops;
+
+	// Desativa todos os recursos interativos (DUMMY_MODE)
+	bool dummy;
+
+	// Imprime cada instrução executada pelo núcleo switch fora do modo step-through
+	bool trace;
+
+	// Comportamento do depurador (START_IN_BREAKING_MODE, BREAK_AT_FAULTS e BREAK_AT_HALT)
+	bool breakAtStart;
+	bool breakAtFaults;
+	bool breakAtHalt;
+
+	// Se o wrap-around do PC é uma falha ou apenas um aviso (FAULT_ON_LOOP_AROUND)
+	bool faultOnWrap;
+
+	// Número de instruções guardadas no diário de execução reversa (0 se desativado)
+	int journal;
+
+	// Se definido, imagem de estado salva pelo comando save de onde a execução continua
+	const char* resume;
+
+	// Comandos do depurador executados antes dos digitados: um arquivo de script (-x) e uma lista
+	// separada por ';' (-e). O script vem primeiro.
+	const char* script;
+	const char* commands;
+
+	// Impressão das mensagens do núcleo pela thread de interface
+	UiPolicy ui;
+
+	// Se definido, nome do segmento de memória compartilhada POSIX onde o estado é publicado a cada
+	// shmInterval instruções
+	const char* shmName;
+	int shmInterval;
+
+	// Apenas converte a imagem de entrada, sem executá-la
+	bool convert;
+
+	// Formato do arquivo de saída (DUMP_*), ou -1 para o padrão: texto, ou com --convert o formato
+	// oposto ao da entrada
+	int dump;
+
+	// Se definido, arquivo onde cada instrução executada é gravada como um registro do trace binário
+	const char* record;
+} Options;
+
+// Guias de controle da interface de usuário. CLI_DO_PROMPT mantém o depurador esperando o próximo
+// comando.
+typedef enum {
+	CLI_DO_NOTHING, CLI_DO_RESET, CLI_DO_QUIT, CLI_DO_PROMPT
+} CliControl;
+
+/// @brief Comando do depurador: nomes aceitos, a função que o executa (NULL se não faz nada além de
+/// devolver o controle) e o que o laço principal faz depois dele. Comandos que podem falhar ao
+/// alterar o estado do emulador usam apply no lugar de run; se ela devolve false, o depurador
+/// continua esperando o próximo comando.
+typedef struct {
+	const char* names[4];
+	void (*run)();
+	CliControl control;
+	bool (*apply)();
+} CliCommand;
 
 
 /// @brief Permite a manipulação e concatenação de strings formatadas
@@ -157,21 +404,15 @@ typedef struct StringBufferT {
 } StringBuffer;
 
 
-// -- Funções de manipulação de vetor dinâmico
+// -- Funções auxiliares genéricas
 
-void vecInit(Vector* vec);
-void vecFree(Vector* vec);
-void vecGrow(Vector* vec);
-void vecAdd(Vector* vec, void* elem);
-void vecRemove(Vector* vec, int index);
 void prints(const char* fmt, ...);
 
-// -- Funções auxiliares genéricas
-
 bool strEquals(const char* a, const char* b);
 void setBit(uint16_t* reg, int bit, bool value);
 bool getBit(uint16_t value, int bit);
 void toLowerCase(char* str);
+double getTimeSeconds();
 
 // -- Funções auxiliares de manipulação de strings
 
@@ -185,6 +426,7 @@ void stbFree(StringBuffer*);
 
 // -- Funções de interface de linha de comando
 
+int cliParseArgs(int argc, char* argv[]);
 void cliPrintWelcome();
 CliControl cliBeforeExecute();
 void emuCheckBreakpoints();
@@ -192,30 +434,116 @@ CliControl cliWaitUserCommand();
 void cliInstallIntHandler();
 void cliStepCmd();
 void cliBreakpointCmd();
+void cliWatchCmd();
+void cliUnwatchCmd();
+void cliTraceCmd();
 void cliContinueCmd();
 void cliDisassemblyCmd();
 void cliMemoryCmd();
 void cliHelpCmd();
+bool cliBackCmd();
+void cliSaveCmd();
+bool cliLoadCmd();
+void cliDiffCmd();
+bool cliReverseContinueCmd();
+void cliResetCmd();
+void cliNoBreakCmd();
+void cliDoBreakCmd();
+bool cliReadCommand(char* line, size_t size);
 void signIntHandler(int sign);
+bool cliPollInterrupt();
 
 // -- Funções de execução do emulador
 
+// Intervalo, em instruções, entre as amostras do detector de laços no núcleo padrão
+#define DETECTOR_INTERVAL 64
+
+// Número de instruções executadas livremente entre duas consultas ao pedido de interrupção e à
+// publicação do estado na memória compartilhada
+#define RUN_CHUNK_SIZE 4096
+
+// Tamanho padrão do diário de execução reversa e intervalo, em instruções, entre os seus checkpoints
+#define JOURNAL_DEFAULT_CAPACITY 0x10000
+#define JOURNAL_CHECKPOINT_INTERVAL 4096
+
+// Intervalo padrão, em instruções, entre as publicações do estado na memória compartilhada
+#define SHM_DEFAULT_INTERVAL 100000
+
 void emuInitialize(uint16_t* memory, int memorySize);
 void emuReset();
+EmuResult emuRunHeadless();
+void emuRunSwitch();
+EmuResult emuRunThreaded();
+EmuResult emuRunJit();
+void aotCompile(FILE* out);
 uint16_t emuFetch();
-void emuAdvance();
+void emuDetectorInitialize();
+bool emuDetectorSample(uint16_t pc);
+void emuLoopRange(uint16_t* low, uint16_t* high);
+void journalInitialize(int capacity);
+void journalClear();
+static inline void journalRecord(uint16_t instruction);
+bool journalSeek(uint64_t target);
+bool journalTrapStops(uint16_t addr);
+bool emuSaveState(const char* path);
+bool emuLoadState(const char* path);
+int emuNextDifference(int from);
+int imageLoad(const char* path, uint16_t** memory, int* memorySize);
+int imageWrite(FILE* out, const uint16_t* memory, int memorySize);
+int imageWriteDelta(FILE* out, bool binary);
+void imageUnmap(uint16_t* memory);
+EmuResult emuAdvance();
 EmuResult emuExecute(uint16_t instruction);
-void emuDoArit(uint16_t argument);
+EmuResult emuExecuteWatched(uint16_t instruction);
+bool emuCheckWatchpoint(uint16_t address, uint8_t access, uint16_t before);
+EmuResult emuDoArit(uint16_t argument);
 uint16_t* emuGetRegister(uint8_t code);
+void emuDecode(uint16_t address);
+void emuInvalidate(uint16_t address);
+void emuInvalidateAll();
+void emuSyncFlags();
+bool jitInitialize();
+void jitInvalidate(uint16_t address);
+void jitInvalidateAll();
 void emuFault(const char* fmt, ...);
 void emuWarn(const char* fmt, ...);
 void emuSetBreakpoint(uint16_t addr, int hits);
-Breakpoint * emuGetBreakpoint(uint16_t addr);
+bool emuRemoveBreakpoint(uint16_t addr);
+bool emuHasBreakpoint(uint16_t addr);
+static inline bool emuBreakpointActive(uint16_t addr);
+void emuSetBreakpointCondition(uint16_t addr, BreakCondition* condition);
+bool emuBreakpointStops(uint16_t addr);
+bool emuPassBreakpoint(uint16_t addr);
+const char* exprCompile(const char* text, Expr* expr);
+int32_t exprEvaluate(const Expr* expr, uint32_t hits);
+void exprFree(Expr* expr);
+void emuSetWatchpoint(uint16_t addr, uint8_t kinds, int hits);
+bool emuRemoveWatchpoint(uint16_t addr);
+static inline bool emuAccessWatched(uint16_t instruction);
+static inline bool emuTrapActive(uint16_t address);
 bool emuGuardAddress(uint16_t addr);
 void emuBadInstruction();
 void emuDumpRegisters();
 void emuPrintDisassemblyLine(uint16_t address);
+void emuWriteDisassemblyLine(uint16_t address, uint16_t instruction, int breakpointHits);
 StringBuffer emuDisassembly(uint16_t instruction);
+void uiStart();
+void uiStop();
+void uiFlush();
+void uiTrace(uint16_t address);
+void uiPrintf(const char* fmt, ...);
+bool shmOpen(const char* name);
+void shmClose();
+void shmPublish();
+bool recorderOpen(const char* path);
+void recorderClose();
+static inline void recorderRecord(uint16_t pc, uint16_t instruction, EmuResult result);
+
+// Nome de cada tipo de superinstrução, usado no relatório do modo headless
+static const char* const FUSION_NAMES[] = {
+	"LDA+ARIT+STA",
+	"SUB+JNZ"
+};
 
 // Tabela com o nome das intruções para cada opcode
 static const char* const INSTRUCTION_NAMES[] = {
@@ -276,15 +604,186 @@ static const char* const ARIT_EXT_FMT[] = {
 // Estrutura globais de emulação
 static Emul emulator;
 static time_t lastInterruptBreak;
+
+// Pedido de interrupção feito pelo CTRL-C. É a única variável escrita pelo handler do sinal; os
+// núcleos apenas a leem entre blocos de instruções e cliBeforeExecute a consome
+static volatile sig_atomic_t interruptPending = 0;
 static bool extendedNotation = false;
+static Options options = {
+	.headless = false, .core = CORE_SWITCH, .aotOutput = NULL, .fusion = true, .detectLoops = false,
+	.dummy = DUMMY_MODE, .trace = true, .breakAtStart = START_IN_BREAKING_MODE,
+	.breakAtFaults = BREAK_AT_FAULTS, .breakAtHalt = BREAK_AT_HALT, .faultOnWrap = FAULT_ON_LOOP_AROUND,
+	.journal = 0, .resume = NULL, .script = NULL, .commands = NULL,
+	.ui = UI_BLOCK, .shmName = NULL, .shmInterval = SHM_DEFAULT_INTERVAL,
+	.convert = false, .dump = -1, .record = NULL
+};
+
+// Estado do detector de laços infinitos (algoritmo de Brent sobre amostras do estado da máquina)
+static struct {
+	// Hash da memória, mantido incrementalmente a cada escrita por emuStore
+	uint64_t memoryHash;
+
+	// Estado salvo ("tartaruga") e cópia da memória naquele ponto, para confirmar a repetição
+	Fingerprint saved;
+	uint16_t* savedMemory;
+	bool hasSaved;
+
+	// Amostras desde o último estado salvo e limite até salvar de novo
+	uint64_t lambda;
+	uint64_t power;
+
+	// Instruções até a próxima amostra no núcleo padrão
+	int countdown;
+} detector;
+
+/// @brief Registro no diário do que uma instrução alterou, para que ela possa ser desfeita: PC, R
+/// e PSW anteriores, e o valor anterior do registrador destino ou da palavra escrita por um STA
+typedef struct {
+	uint16_t PC, R, PSW;
+	uint16_t value;
+	uint16_t address;
+	uint8_t kind;
+	uint8_t reg;
+} JournalEntry;
+
+// O que JournalEntry.value guarda além de PC, R e PSW
+#define JOURNAL_NONE     0
+#define JOURNAL_REGISTER 1
+#define JOURNAL_MEMORY   2
+
+/// @brief Estado completo da máquina antes da instrução número position
+typedef struct {
+	uint64_t position;
+	Registers registers;
+	uint16_t* memory;
+} JournalCheckpoint;
+
+// Diário de execução reversa. Um buffer circular com o registro de cada instrução executada e
+// checkpoints periódicos do estado completo. Ativado pela opção --journal.
+static struct {
+	JournalEntry* entries;
+	int capacity;
+
+	// Instruções executadas desde o último reset e a mais antiga que ainda pode ser desfeita
+	uint64_t position;
+	uint64_t oldest;
+
+	JournalCheckpoint* checkpoints;
+	int checkpointCount;
+
+	// Reexecutando a partir de um checkpoint, ou uma volta do laço encontrado pelo detector de laços.
+	// Falhas e avisos já foram relatados da primeira vez.
+	bool replaying;
+} journal;
+
+/// @brief Estado publicado na memória compartilhada. sequence é ímpar enquanto o emulador escreve;
+/// um leitor copia o estado entre duas leituras de sequence e só aceita a cópia se as duas forem
+/// iguais e pares (seqlock).
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t memorySize;
+	uint32_t sequence;
+	uint32_t reserved;
+	uint64_t instructionCount;
+	Registers registers;
+	uint16_t memory[];
+} ShmState;
+
+#define SHM_MAGIC "OACSHM"
+#define SHM_VERSION 1
+
+// Segmento de memória compartilhada aberto pela opção --shm
+static struct {
+	ShmState* state;
+	size_t size;
+
+	// Contagem de instruções a partir da qual o estado deve ser publicado de novo
+	uint64_t next;
+} shm;
+
+// Número de registros guardados na memória antes de serem escritos no arquivo do trace binário
+#define TRACE_BUFFER_RECORDS (1 << 16)
+
+// Trace binário gravado pela opção --record
+static struct {
+	FILE* file;
+	TraceRecord* buffer;
+	int count;
+
+	// PC e PSW do último registro, dos quais o próximo guarda a diferença
+	uint16_t pc;
+	uint16_t psw;
+} recorder;
+
+// Imagem binária de memória carregada por imageLoad
+static struct {
+	// A entrada era uma imagem binária
+	bool binary;
+
+	// Memória viva e visão somente leitura do arquivo, as duas mapeadas com MAP_PRIVATE. Elas
+	// compartilham as páginas do arquivo até o primeiro STA em cada página. snapshot é NULL quando a
+	// imagem foi copiada para um bloco alocado (Windows e máquinas big-endian).
+	uint16_t* memory;
+	uint16_t* snapshot;
+
+	// Endereço da primeira instrução executada
+	uint16_t entryPC;
+
+	// Número de palavras e tamanho do arquivo mapeado
+	int words;
+	size_t size;
+} image;
 bool terminalColorsEnabled = ENABLE_COLORS;
 
 /// @brief Entrada principal do programa. Essa função é chamada com um bloco de memória que corresponde ao
 /// estado inicial da memória do programa a ser emulado.
 /// O bloco de memória é válido durante toda a função principal.
+/// @return PROCESSA_OK, PROCESSA_NO_OUTPUT se nada foi executado e a memória não deve ser escrita, ou
+/// PROCESSA_NON_TERMINATING se o programa foi interrompido pelo detector de laços.
 int processa(short int* m, int memSize) {
 	uint16_t* memory = (uint16_t*)m;
 
+	// Recompilação estática: apenas gera o programa C equivalente, sem executar nada
+	if (options.aotOutput) {
+		FILE* out = fopen(options.aotOutput, "w");
+		if (!out) {
+			fprintf(stderr, "Could not open '%s' for writing.\n", options.aotOutput);
+			return PROCESSA_NO_OUTPUT;
+		}
+
+		emuInitialize(memory, memSize);
+		aotCompile(out);
+		fclose(out);
+		return PROCESSA_NO_OUTPUT;
+	}
+
+	// Conversão: nada é executado e o driver escreve a memória de entrada, por padrão no formato
+	// oposto ao dela. Sem execução, um delta seria sempre vazio.
+	if (options.convert) {
+		if (options.dump < 0 || options.dump >= DUMP_DELTA) {
+			options.dump = image.binary ? DUMP_TEXT : DUMP_BINARY;
+		}
+		if (options.dump == DUMP_TEXT && image.entryPC) {
+			fprintf(stderr, "The text format has no entry address, 0x%03X is lost.\n", image.entryPC);
+		}
+		return PROCESSA_OK;
+	}
+
+	// No modo headless não há interface alguma, apenas a execução e o relatório final
+	if (options.headless) {
+		emuInitialize(memory, memSize);
+		if (options.resume && !emuLoadState(options.resume)) exit(1);
+		if (options.shmName && !shmOpen(options.shmName)) exit(1);
+		if (options.record && !recorderOpen(options.record)) exit(1);
+
+		EmuResult result = emuRunHeadless();
+		shmClose();
+		recorderClose();
+		if (result == EMU_LOOP) return PROCESSA_NON_TERMINATING;
+		return PROCESSA_OK;
+	}
+
 	// Imprime o cabeçalho de boas vindas
 	cliPrintWelcome();
 	
@@ -294,11 +793,41 @@ int processa(short int* m, int memSize) {
 	// Inicializa as estruturas do emulador
 	emuInitialize(memory, memSize);
 
+	// Continua a partir de uma imagem de estado salva anteriormente
+	if (options.resume) {
+		if (!emuLoadState(options.resume)) exit(1);
+		printf("Resumed from '%s' at instruction %llu.\n", options.resume,
+			(unsigned long long)emulator.instructionCount);
+	}
+
+	// Publica o estado para ferramentas externas e grava o trace binário, se pedido
+	if (options.shmName && !shmOpen(options.shmName)) exit(1);
+	if (options.record && !recorderOpen(options.record)) exit(1);
+
 	printf("Memory size: 0x%X words.\n", memSize);
 	printf("Beginning execution...\n\n");
 
+	// A partir daqui, as mensagens do núcleo passam pela thread de interface
+	uiStart();
+
 	Registers* regs = emulator.registers;
 	do {
+		// Enquanto o emulador não estiver parado, as instruções são executadas pelo núcleo escolhido
+		// até um breakpoint, HLT, falha ou CTRL-C. Os núcleos threaded e JIT executam sem trace.
+		// A instrução onde ele parou segue então pelo caminho normal abaixo.
+		if (!emulator.breaking) {
+			if (options.core == CORE_THREADED) {
+				emuRunThreaded();
+			} else if (options.core == CORE_JIT) {
+				emuRunJit();
+			} else {
+				emuRunSwitch();
+			}
+		}
+
+		// Antes de imprimir qualquer coisa diretamente, espera as mensagens da execução livre
+		uiFlush();
+
 		// Lê a instrução atual
 		uint16_t instruction = emuFetch();
 
@@ -314,8 +843,15 @@ int processa(short int* m, int memSize) {
 		// Se o usuário pediu para sair do programa, saia do loop
 		if (ctrl == CLI_DO_QUIT) break;
 
-		// Executa a instrução
-		EmuResult result = emuExecute(instruction);
+		// Com o diário ativo, registra o que a instrução vai alterar
+		if (journal.entries) journalRecord(instruction);
+
+		// Executa a instrução. Com algum watchpoint armado, passa pela variante instrumentada
+		uint16_t pc = regs->PC;
+		EmuResult result = emulator.activeWatchpoints
+			? emuExecuteWatched(instruction) : emuExecute(instruction);
+		emulator.instructionCount++;
+		if (recorder.file) recorderRecord(pc, instruction, result);
 
 		// Se a instrução era um HALT, sai do loop
 		if (result == EMU_HALT) break;
@@ -326,9 +862,185 @@ int processa(short int* m, int memSize) {
 	// Guarda adicional: O programa cessa ao encontrar HLT
 	} while ((regs->RI & 0xF000) != 0xF000);
 
+	uiStop();
+	shmClose();
+	recorderClose();
 	printf("\nCPU Halted.\n");
 
-	return 0;
+	return PROCESSA_OK;
+}
+
+/// @brief Interpreta as opções de linha de comando do emulador. As opções reconhecidas são removidas
+/// de argv e os argumentos restantes (arquivos de entrada e saída) são compactados no início do vetor.
+/// @return O novo número de argumentos em argv.
+int cliParseArgs(int argc, char* argv[]) {
+	int remaining = 1;
+	for (int i = 1; i < argc; i++) {
+		char* arg = argv[i];
+
+		// Argumentos que não começam com '-' são repassados ao driver
+		if (arg[0] != '-') {
+			argv[remaining++] = arg;
+			continue;
+		}
+
+		if (strEquals(arg, "-H") || strEquals(arg, "--headless")) {
+			options.headless = true;
+			continue;
+		}
+
+		if (strEquals(arg, "--core=switch")) {
+			options.core = CORE_SWITCH;
+			continue;
+		}
+
+		if (strEquals(arg, "--core=threaded")) {
+			options.core = CORE_THREADED;
+			continue;
+		}
+
+		if (strEquals(arg, "--core=jit")) {
+			options.core = CORE_JIT;
+			continue;
+		}
+
+		if (strEquals(arg, "--detect-loops")) {
+			options.detectLoops = true;
+			continue;
+		}
+
+		if (strEquals(arg, "--no-fusion")) {
+			options.fusion = false;
+			continue;
+		}
+
+		if (strEquals(arg, "--dummy")) {
+			options.dummy = true;
+			continue;
+		}
+
+		if (strEquals(arg, "--no-trace")) {
+			options.trace = false;
+			continue;
+		}
+
+		if (strEquals(arg, "--no-break-at-start")) {
+			options.breakAtStart = false;
+			continue;
+		}
+
+		if (strEquals(arg, "--no-break-at-faults")) {
+			options.breakAtFaults = false;
+			continue;
+		}
+
+		if (strEquals(arg, "--no-break-at-halt")) {
+			options.breakAtHalt = false;
+			continue;
+		}
+
+		if (strEquals(arg, "--allow-wrap")) {
+			options.faultOnWrap = false;
+			continue;
+		}
+
+		if (strEquals(arg, "--journal")) {
+			options.journal = JOURNAL_DEFAULT_CAPACITY;
+			continue;
+		}
+
+		if (strncmp(arg, "--journal=", 10) == 0 && atoi(arg + 10) > 0) {
+			options.journal = atoi(arg + 10);
+			continue;
+		}
+
+		if (strEquals(arg, "--ui-thread=block")) {
+			options.ui = UI_BLOCK;
+			continue;
+		}
+
+		if (strEquals(arg, "--ui-thread=drop")) {
+			options.ui = UI_DROP;
+			continue;
+		}
+
+		if (strEquals(arg, "--ui-thread=off")) {
+			options.ui = UI_SYNC;
+			continue;
+		}
+
+		if (strncmp(arg, "--shm=", 6) == 0 && arg[6]) {
+			options.shmName = arg + 6;
+			continue;
+		}
+
+		if (strncmp(arg, "--shm-interval=", 15) == 0 && atoi(arg + 15) > 0) {
+			options.shmInterval = atoi(arg + 15);
+			continue;
+		}
+
+		if (strEquals(arg, "-x") && i + 1 < argc) {
+			options.script = argv[++i];
+			continue;
+		}
+
+		if (strEquals(arg, "-e") && i + 1 < argc) {
+			options.commands = argv[++i];
+			continue;
+		}
+
+		if (strncmp(arg, "--record=", 9) == 0 && arg[9]) {
+			options.record = arg + 9;
+			continue;
+		}
+
+		if (strncmp(arg, "--resume=", 9) == 0 && arg[9]) {
+			options.resume = arg + 9;
+			continue;
+		}
+
+		if (strncmp(arg, "--aot=", 6) == 0 && arg[6]) {
+			options.aotOutput = arg + 6;
+			continue;
+		}
+
+		if (strEquals(arg, "--dump=text")) {
+			options.dump = DUMP_TEXT;
+			continue;
+		}
+
+		if (strEquals(arg, "--dump=binary")) {
+			options.dump = DUMP_BINARY;
+			continue;
+		}
+
+		if (strEquals(arg, "--dump=delta")) {
+			options.dump = DUMP_DELTA;
+			continue;
+		}
+
+		if (strEquals(arg, "--dump=delta-binary")) {
+			options.dump = DUMP_DELTA_BINARY;
+			continue;
+		}
+
+		if (strEquals(arg, "--convert")) {
+			options.convert = true;
+			continue;
+		}
+
+		fprintf(stderr, "Unknown option '%s'.\n", arg);
+		exit(1);
+	}
+
+	argv[remaining] = NULL;
+	return remaining;
+}
+
+/// @brief Formato em que o driver deve escrever a memória final
+/// @return Um dos formatos DUMP_*.
+int cliDumpFormat() {
+	return options.dump < 0 ? DUMP_TEXT : options.dump;
 }
 
 // Imprime o cabeçalho de boas vindas
@@ -339,7 +1051,9 @@ void cliPrintWelcome() {
 
 // Instala signIntHandler como um monitor para o CTRL-C
 void cliInstallIntHandler() {
-	#if !DUMMY_MODE && INSTALL_SIGINT_HANDLER
+	#if INSTALL_SIGINT_HANDLER
+	if (options.dummy) return;
+
 	printf("Press CTRL-C to break execution and start debugging.\n");
 	time(&lastInterruptBreak);
 	signal(SIGINT, signIntHandler);
@@ -350,6 +1064,9 @@ void cliInstallIntHandler() {
 // Se o emulador estiver em step-through, aqui haverá uma chamada para cliWaitUserCommand()
 // para que o usuário interaja com o emulador
 CliControl cliBeforeExecute() {
+	// Se o CTRL-C foi pressionado durante a execução, entra no modo step-through
+	cliPollInterrupt();
+
 	// Verifica e para em breakpoints nessa instrução se houverem
 	emuCheckBreakpoints();
 
@@ -373,163 +1090,286 @@ CliControl cliBeforeExecute() {
 /// @brief Verifica se há um breakpoint válido na instrução atual.
 /// Caso houver, pare a execução do emulador e imprime uma mensagem na tela.
 void emuCheckBreakpoints() {
-	// Obtém o breakpoint declarado nessa posição de memória
 	uint16_t PC = emulator.registers->PC;
-	Breakpoint* bp = emuGetBreakpoint(PC);
 
-	// Se houver o breakpoint e ele ainda estiver ativo
-	if (bp && bp->hits != 0) {
+	// Voltando no tempo ou restaurando um estado salvo, o breakpoint já foi contado quando a instrução
+	// foi alcançada pela primeira vez
+	if (emulator.rewound) {
+		emulator.rewound = false;
+		return;
+	}
+
+	// Se houver um breakpoint ativo nessa posição de memória e a sua condição for verdadeira (ou já
+	// tiver sido confirmada pelo núcleo que parou aqui)
+	bool hit = emuBreakpointActive(PC) && (emulator.breakpointConfirmed || emuBreakpointStops(PC));
+	emulator.breakpointConfirmed = false;
+
+	if (hit) {
 		// Coloca o emulador em modo step-through
 		emulator.stepsLeft = 0;
 		emulator.breaking = true;
 
-		if (bp->hits > 0) bp->hits--;
+		int hits = emulator.breakpointHits[PC];
+		if (hits > 0) emuSetBreakpoint(PC, --hits);
 		printf(TERM_GREEN "You've hit a breakpoint at " TERM_YELLOW "0x%03X.\n" TERM_RESET, PC);
 		
-		if (bp->hits > 0) {
-			printf(TERM_GREEN "This breakpoint has" TERM_YELLOW " %i " TERM_GREEN "hits left.\n" TERM_RESET, bp->hits);
-		} else if (bp->hits == 0) {
+		if (hits > 0) {
+			printf(TERM_GREEN "This breakpoint has" TERM_YELLOW " %i " TERM_GREEN "hits left.\n" TERM_RESET, hits);
+		} else if (hits == 0) {
 			printf(TERM_GREEN "This breakpoint was disabled.\n" TERM_RESET);
 		}
 	} else {
-		#if BREAK_AT_HALT && !DUMMY_MODE
-			uint16_t opcode = (emulator.registers->RI & 0xF000) >> 12;
-			if (opcode == OPCODE_HLT) {
-				// Coloca o emulador em modo step-through
-				emulator.stepsLeft = 0;
-				emulator.breaking = true;
-			}
-		#endif
+		uint16_t opcode = (emulator.registers->RI & 0xF000) >> 12;
+		if (opcode == OPCODE_HLT && options.breakAtHalt && !options.dummy) {
+			// Coloca o emulador em modo step-through
+			emulator.stepsLeft = 0;
+			emulator.breaking = true;
+		}
 	}
 }
 
-// Loop do prompt de comandos quando emulador estiver parado
-CliControl cliWaitUserCommand() {
-#define _COMMAND_BUFFER_SIZE 128
-	const size_t BUFFER_SIZE = _COMMAND_BUFFER_SIZE;
-	static char commandBuffer1[128] = { 0 };
-	static char commandBuffer2[128] = { 0 };
-	static bool firstBreak = true;
+/// @brief Verifica se o acesso de uma instrução a um endereço observado dispara o watchpoint.
+/// Caso dispare, para a execução do emulador logo após a instrução e imprime uma mensagem na tela.
+/// @param access WATCH_READ ou WATCH_WRITE
+/// @param before Valor da palavra antes da execução da instrução
+/// @return Se o watchpoint disparou.
+bool emuCheckWatchpoint(uint16_t address, uint8_t access, uint16_t before) {
+	uint16_t after = emulator.memory[address];
+	uint8_t kinds = emulator.watchKinds[address];
 
-	static char* commandBuffer = commandBuffer1;
-	static char* lastCommand = commandBuffer2;
+	bool changed = access == WATCH_WRITE && (kinds & WATCH_CHANGE) && before != after;
+	if (!(kinds & access) && !changed) return false;
 
-	// Se é a primeira vez que o usuário para a execução
-	if (firstBreak) {
-		firstBreak = false;
-		printf(TERM_GREEN "You are in step-through mode. ");
-		printf("You can view memory contents, registers and disassembly.\n");
-		printf("Type " TERM_YELLOW "help" TERM_GREEN " to view all commands.\n" TERM_RESET);
-	}
+	// Coloca o emulador em modo step-through
+	emulator.stepsLeft = 0;
+	emulator.breaking = true;
 
-	// Loop infinito apenas interrompido quando o usuário digitar um comando válido
-	while (true) {	
-		// Lê uma linha de comando
-		printf(TERM_BOLD_CYAN ">> " TERM_YELLOW);		
-		fgets(commandBuffer, BUFFER_SIZE, stdin);
-		printf("%s", TERM_RESET);
+	int hits = emulator.watchHits[address];
+	if (hits > 0) emuSetWatchpoint(address, kinds, --hits);
 
-		// Remove a quebra de linha da string
-		for (int i = 0; i < BUFFER_SIZE; i++) {
-			if (commandBuffer[i] == '\n') {
-				commandBuffer[i] = '\0';
-				break;
-			}
-		}
+	if (access == WATCH_READ) {
+		uiPrintf(TERM_GREEN "Watchpoint at " TERM_YELLOW "0x%03X" TERM_GREEN " read " TERM_YELLOW "0x%04X"
+			TERM_GREEN " by the instruction at " TERM_YELLOW "0x%03X.\n" TERM_RESET,
+			address, after, emulator.registers->PC);
+	} else {
+		uiPrintf(TERM_GREEN "Watchpoint at " TERM_YELLOW "0x%03X" TERM_GREEN " written " TERM_YELLOW "0x%04X -> 0x%04X"
+			TERM_GREEN " by the instruction at " TERM_YELLOW "0x%03X.\n" TERM_RESET,
+			address, before, after, emulator.registers->PC);
+	}
 
-		// Se a linha digitada for completamente vazia, o usuário apenas apertou enter e o comando
-		// anterior deve ser executado novamente
-		char cmdLine[_COMMAND_BUFFER_SIZE];
-		if (commandBuffer[0] == '\0') {
-			strncpy(cmdLine, lastCommand, BUFFER_SIZE);
-		} else {
-			strncpy(cmdLine, commandBuffer, BUFFER_SIZE);
+	if (hits > 0) {
+		uiPrintf(TERM_GREEN "This watchpoint has" TERM_YELLOW " %i " TERM_GREEN "hits left.\n" TERM_RESET, hits);
+	} else if (hits == 0) {
+		uiPrintf(TERM_GREEN "This watchpoint was disabled.\n" TERM_RESET);
+	}
 
-			// Faz o swap do buffer de comando anterior e atual
-			char* tmp = commandBuffer;
-			commandBuffer = lastCommand;
-			lastCommand = tmp;
-		}
+	return true;
+}
 
-		if (cmdLine[0] == '\0') continue;
+// Tabela de comandos do depurador. O primeiro nome de cada comando é o principal.
+static const CliCommand CLI_COMMANDS[] = {
+	// step <amount>: Permite executar um número de instruções em sequência
+	{ { "s", "step" },                         cliStepCmd,            CLI_DO_NOTHING },
 
-		// Obtém o comando principal antes do espaço
-		char* cmd = strtok(cmdLine, " ");
-		toLowerCase(cmd);
+	// continue: Desativa o modo step-through do emulador
+	{ { "c", "continue" },                     cliContinueCmd,        CLI_DO_NOTHING },
 
-		// Comando step <amount>: Permite executar um número de instruções em sequência
-		if (strEquals(cmd, "s") || strEquals(cmd, "step")) {
-			cliStepCmd();
-			break;
-		}
+	// registers: Imprime o conteúdo de todos os registradores
+	{ { "r", "regs", "registers" },            emuDumpRegisters,      CLI_DO_PROMPT },
 
-		// Comando continue: Desativa o modo step-through do emulador
-		if (strEquals(cmd, "c") || strEquals(cmd, "continue")) {
-			cliContinueCmd();
-			break;
-		}
+	// disassembly [address] [amount]: Imprime um número de instruções no endereço dado. Se não
+	// for passado um endereço, imprime a instrução atual
+	{ { "d", "disassembly" },                  cliDisassemblyCmd,     CLI_DO_PROMPT },
 
-		// Comando registers: Imprime o conteúdo de todos os registradores
-		if (strEquals(cmd, "r") || strEquals(cmd, "regs") || strEquals(cmd, "registers")) {
-			emuDumpRegisters();
-			continue;
-		}
+	// memory <address> [words]: Observa a memória no ponto dado
+	{ { "m", "x", "memory" },                  cliMemoryCmd,          CLI_DO_PROMPT },
 
-		// Comando disassembly [address] [amount]: Imprime um número de instruções no endereço dado
-		// Se não for passado um endereço. Imprime a instrução atual
-		if (strEquals(cmd, "d") || strEquals(cmd, "disassembly")) {
-			cliDisassemblyCmd();
-			continue;
-		}
+	// break <address> [hits] [if <expr>]
+	{ { "b", "break" },                        cliBreakpointCmd,      CLI_DO_PROMPT },
 
-		// Comando memory <address> [words]: Observa a memória no ponto dado
-		if (strEquals(cmd, "m") || strEquals(cmd, "x") || strEquals(cmd, "memory")) {
-			cliMemoryCmd();
-			continue;
+	// trace <address> <expr> [if <expr>]
+	{ { "t", "trace" },                        cliTraceCmd,           CLI_DO_PROMPT },
+
+	// watch <address> [r|w|rw|c] [hits]
+	{ { "w", "watch" },                        cliWatchCmd,           CLI_DO_PROMPT },
+
+	// unwatch <address>
+	{ { "unwatch" },                           cliUnwatchCmd,         CLI_DO_PROMPT },
+
+	// back [amount | #instruction]: Volta no tempo um número de instruções
+	{ { "back" },                              NULL,                  CLI_DO_RESET, cliBackCmd },
+
+	// reverse-continue: Volta no tempo até o último breakpoint ou watchpoint
+	{ { "rc", "reverse-continue" },            NULL,                  CLI_DO_RESET, cliReverseContinueCmd },
+
+	// save <file>: Salva o estado completo do emulador em um arquivo
+	{ { "save" },                              cliSaveCmd,            CLI_DO_PROMPT },
+
+	// load <file>: Restaura um estado salvo pelo comando save
+	{ { "load" },                              NULL,                  CLI_DO_RESET, cliLoadCmd },
+
+	// diff: Lista as palavras da memória alteradas desde o início do programa
+	{ { "diff" },                              cliDiffCmd,            CLI_DO_PROMPT },
+
+	// quit: Sai do emulador
+	{ { "q", "quit" },                         NULL,                  CLI_DO_QUIT },
+
+	// reset: Reinicia o emulador com a memória original e os registradores em 0
+	{ { "reset" },                             cliResetCmd,           CLI_DO_RESET },
+
+	// nobreak: Desabilita a parada do emulator no lançamento de falhas
+	{ { "nobreak" },                           cliNoBreakCmd,         CLI_DO_PROMPT },
+
+	// dobreak: Rehabilita a parada do emulator no lançamento de falhas
+	{ { "dobreak" },                           cliDoBreakCmd,         CLI_DO_PROMPT },
+
+	// help: Imprime a ajuda do programa
+	{ { "help" },                              cliHelpCmd,            CLI_DO_PROMPT },
+};
+
+/// @brief Procura na tabela o comando com o nome dado
+/// @return O comando, ou NULL se não existe
+static const CliCommand* cliFindCommand(const char* name) {
+	for (size_t i = 0; i < sizeof(CLI_COMMANDS) / sizeof(CLI_COMMANDS[0]); i++) {
+		const CliCommand* command = &CLI_COMMANDS[i];
+		for (int j = 0; j < 4 && command->names[j]; j++) {
+			if (strEquals(command->names[j], name)) return command;
 		}
+	}
+	return NULL;
+}
+
+// Loop do prompt de comandos quando emulador estiver parado
+CliControl cliWaitUserCommand() {
+#define _COMMAND_BUFFER_SIZE 128
+	static bool firstBreak = true;
+
+	// Com o emulador parado, a PSW precisa estar atualizada para ser inspecionada
+	emuSyncFlags();
+
+	// As mensagens do núcleo vêm antes do prompt
+	uiFlush();
+
+	// Ferramentas externas veem o estado em que o emulador parou
+	if (shm.state) shmPublish();
+
+	// Se é a primeira vez que o usuário para a execução
+	if (firstBreak) {
+		firstBreak = false;
+		printf(TERM_GREEN "You are in step-through mode. ");
+		printf("You can view memory contents, registers and disassembly.\n");
+		printf("Type " TERM_YELLOW "help" TERM_GREEN " to view all commands.\n" TERM_RESET);
+	}
+
+	// Loop infinito apenas interrompido quando o usuário digitar um comando que devolve o controle
+	while (true) {
+		// Lê o próximo comando. Sem mais comandos (fim da entrada padrão), sai do emulador.
+		char cmdLine[_COMMAND_BUFFER_SIZE];
+		if (!cliReadCommand(cmdLine, sizeof(cmdLine))) return CLI_DO_QUIT;
+
+		// Obtém o comando principal antes do espaço
+		char* cmd = strtok(cmdLine, " ");
+		if (!cmd) continue;
+		toLowerCase(cmd);
 
-		// Comando break <address> [hits]
-		if (strEquals(cmd, "b") || strEquals(cmd, "break")) {
-			cliBreakpointCmd();
+		const CliCommand* command = cliFindCommand(cmd);
+		if (!command) {
+			printf(TERM_BOLD_RED "Unknown command '%s'. ", cmd);
+			printf("Type 'help' for a list of commands.\n" TERM_RESET);
 			continue;
 		}
 
-		// Comando quit: Sai do emulador
-		if (strEquals(cmd, "q") || strEquals(cmd, "quit")) {
-			return CLI_DO_QUIT;
-		}
+		if (command->run) command->run();
+		if (command->apply && !command->apply()) continue;
+		if (command->control != CLI_DO_PROMPT) return command->control;
+	}
+#undef _COMMAND_BUFFER_SIZE
+}
 
-		// Comando reset: Reinicia o emulador com a memória original e os registradores em 0
-		if (strEquals(cmd, "reset")) {
-			printf("Reseting all registers and memory.");
-			emuReset();
-			printf(" Done.\n");
-			return CLI_DO_RESET;
+/// @brief Obtém o próximo comando do depurador. Os comandos vêm primeiro do script (-x), depois da
+/// lista da opção -e e por fim da entrada padrão. Cada linha pode ter vários comandos separados por
+/// ';'. Nos scripts, linhas começando com '#' são comentários; na entrada padrão, uma linha vazia
+/// repete o último comando digitado.
+/// @return false quando não há mais comandos.
+bool cliReadCommand(char* command, size_t size) {
+	static FILE* script = NULL;
+	static bool scriptOpened = false;
+	static bool commandListRead = false;
+
+	// Linha atual e a posição do próximo comando nela
+	static char line[1024] = { 0 };
+	static char* next = NULL;
+	static char lastLine[1024] = { 0 };
+
+	if (!scriptOpened) {
+		scriptOpened = true;
+		if (options.script) {
+			script = fopen(options.script, "r");
+			if (!script) printf(TERM_RED "Could not open the script '%s'.\n" TERM_RESET, options.script);
 		}
+	}
 
-		// Comando nobreak: Desabilita a parada do emulator no lançamento de falhas
-		if (strEquals(cmd, "nobreak")) {
-			emulator.breakOnFaults = false;
+	while (true) {
+		// Ainda há comandos na linha atual
+		if (next && *next) {
+			char* end = strchr(next, ';');
+			if (end) *end = '\0';
+
+			// Copia o comando sem os espaços em volta
+			while (*next == ' ' || *next == '\t') next++;
+			size_t length = strlen(next);
+			while (length > 0 && (next[length - 1] == ' ' || next[length - 1] == '\t')) length--;
+			if (length >= size) length = size - 1;
+			memcpy(command, next, length);
+			command[length] = '\0';
+
+			next = end ? end + 1 : NULL;
+			if (length > 0) return true;
 			continue;
 		}
-
-		// Comando dobreak: Rehabilita a parada do emulator no lançamento de falhas
-		if (strEquals(cmd, "dobreak")) {
-			emulator.breakOnFaults = true;
-			continue;
+		next = NULL;
+
+		bool echo = true;
+		if (script) {
+			// Próxima linha do script
+			if (!fgets(line, sizeof(line), script)) {
+				fclose(script);
+				script = NULL;
+				continue;
+			}
+		} else if (!commandListRead && options.commands) {
+			// A lista da opção -e é tratada como uma única linha
+			commandListRead = true;
+			strncpy(line, options.commands, sizeof(line) - 1);
+		} else {
+			// Lê uma linha de comando digitada
+			printf(TERM_BOLD_CYAN ">> " TERM_YELLOW);
+			char* read = fgets(line, sizeof(line), stdin);
+			printf("%s", TERM_RESET);
+			if (!read) {
+				printf("\n");
+				return false;
+			}
+			echo = false;
 		}
 
-		// Comando help: Imprime a ajuda do programa
-		if (strEquals(cmd, "help")) {
-			cliHelpCmd();
-			continue;
+		// Remove a quebra de linha da string
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (echo) {
+			// Comentários e linhas vazias dos scripts são ignorados
+			if (line[0] == '#' || line[0] == '\0') continue;
+			printf(TERM_BOLD_CYAN ">> " TERM_YELLOW "%s\n" TERM_RESET, line);
+		} else if (line[0] == '\0') {
+			// Se a linha digitada for completamente vazia, o usuário apenas apertou enter e o
+			// comando anterior deve ser executado novamente
+			strcpy(line, lastLine);
+		} else {
+			strcpy(lastLine, line);
 		}
 
-		printf(TERM_BOLD_RED "Unknown command '%s'. ", cmd);
-		printf("Type 'help' for a list of commands.\n" TERM_RESET);
+		next = line;
 	}
-
-	return CLI_DO_NOTHING;
 }
 
 // Desabilita o modo step-through e deixa o emulador voltar a execução
@@ -538,6 +1378,23 @@ void cliContinueCmd() {
 	emulator.breaking = false;
 }
 
+// Reinicia os registradores e a memória do emulador
+void cliResetCmd() {
+	printf("Reseting all registers and memory.");
+	emuReset();
+	printf(" Done.\n");
+}
+
+// Desabilita a parada do emulador no lançamento de falhas
+void cliNoBreakCmd() {
+	emulator.breakOnFaults = false;
+}
+
+// Rehabilita a parada do emulador no lançamento de falhas
+void cliDoBreakCmd() {
+	emulator.breakOnFaults = true;
+}
+
 // Avança um certo número de passos na execução
 void cliStepCmd() {
 	emulator.stepsLeft = 0;
@@ -549,10 +1406,114 @@ void cliStepCmd() {
 	}
 }
 
-/// @brief Comando break [address] [hits] do emulador
+/// @brief Comando back [amount | #instruction] do emulador
+/// @return false se o emulador não voltou no tempo.
+bool cliBackCmd() {
+	if (!journal.entries) {
+		printf(TERM_RED "Reverse execution requires the --journal option.\n" TERM_RESET);
+		return false;
+	}
+
+	// Sem argumento volta uma instrução. Com #, o argumento é o número da instrução de destino.
+	uint64_t target = journal.position ? journal.position - 1 : 0;
+	char* amountStr = strtok(NULL, " ");
+	if (amountStr && amountStr[0] == '#') {
+		target = strtoull(amountStr + 1, NULL, 0);
+	} else if (amountStr) {
+		uint64_t amount = strtoull(amountStr, NULL, 0);
+		target = (amount < journal.position) ? journal.position - amount : 0;
+	}
+
+	if (target >= journal.position) {
+		printf(TERM_RED "Instruction #%llu has not been executed yet.\n" TERM_RESET,
+			(unsigned long long)target);
+		return false;
+	}
+
+	if (target < journal.oldest) {
+		printf(TERM_YELLOW "The journal only goes back to instruction #%llu.\n" TERM_RESET,
+			(unsigned long long)journal.oldest);
+		target = journal.oldest;
+	}
+
+	journalSeek(target);
+	printf(TERM_GREEN "Went back to instruction " TERM_YELLOW "#%llu" TERM_GREEN ".\n" TERM_RESET,
+		(unsigned long long)target);
+	return true;
+}
+
+/// @brief Comando reverse-continue do emulador
+/// @return false se o emulador não voltou no tempo.
+bool cliReverseContinueCmd() {
+	if (!journal.entries) {
+		printf(TERM_RED "Reverse execution requires the --journal option.\n" TERM_RESET);
+		return false;
+	}
+
+	if (journal.position == journal.oldest) {
+		printf(TERM_YELLOW "Already at the oldest instruction in the journal.\n" TERM_RESET);
+		return false;
+	}
+
+	// Desfaz uma instrução por vez até parar antes de uma que o depurador pararia
+	Registers* regs = emulator.registers;
+	do {
+		journalSeek(journal.position - 1);
+		if (emuTrapActive(regs->PC) && journalTrapStops(regs->PC)) {
+			printf(TERM_GREEN "Reversed to a trap at " TERM_YELLOW "0x%03X" TERM_GREEN
+				" (instruction #%llu).\n" TERM_RESET, regs->PC, (unsigned long long)journal.position);
+			return true;
+		}
+	} while (journal.position > journal.oldest);
+
+	printf(TERM_YELLOW "Reached the oldest instruction in the journal, #%llu.\n" TERM_RESET,
+		(unsigned long long)journal.position);
+	return true;
+}
+
+/// @brief Comando save <file> do emulador
+void cliSaveCmd() {
+	char* path = strtok(NULL, " ");
+	if (!path) {
+		printf(TERM_RED "Usage: save <file>\n" TERM_RESET);
+		return;
+	}
+
+	if (emuSaveState(path)) {
+		printf(TERM_GREEN "State saved to '%s'.\n" TERM_RESET, path);
+	}
+}
+
+/// @brief Comando load <file> do emulador
+/// @return false se nenhum estado foi restaurado.
+bool cliLoadCmd() {
+	char* path = strtok(NULL, " ");
+	if (!path) {
+		printf(TERM_RED "Usage: load <file>\n" TERM_RESET);
+		return false;
+	}
+
+	if (!emuLoadState(path)) return false;
+	printf(TERM_GREEN "State loaded from '%s'.\n" TERM_RESET, path);
+	return true;
+}
+
+/// @brief Comando diff do emulador
+void cliDiffCmd() {
+	int count = 0;
+	for (int addr = emuNextDifference(0); addr < emulator.memorySize; addr = emuNextDifference(addr + 1)) {
+		printf(TERM_BOLD_WHITE "[%3Xh] " TERM_RESET "%04X -> %04X\n", addr,
+			emulator.snapshot[addr], emulator.memory[addr]);
+		count++;
+	}
+
+	printf("%d word%s changed since the start of the program.\n", count, count == 1 ? "" : "s");
+}
+
+/// @brief Comando break [address] [hits] [if <expr>] do emulador
 void cliBreakpointCmd() {
 	char* addressStr = strtok(NULL, " ");
-	char* hitsStr = strtok(NULL, " ");
+	char* rest = strtok(NULL, "");
 
 	int address = emulator.registers->PC;
 	int hits = -1;
@@ -560,20 +1521,164 @@ void cliBreakpointCmd() {
 	if (addressStr) {
 		sscanf(addressStr, "%x", &address);
 	}
-	
-	if (hitsStr) {
-		sscanf(hitsStr, "%i", &hits);
+
+	// O número de hits e a condição são opcionais
+	const char* conditionText = NULL;
+	if (rest) {
+		int length = 0;
+		if (sscanf(rest, "%i%n", &hits, &length) == 1) rest += length;
+		while (*rest == ' ') rest++;
+
+		if (strncmp(rest, "if ", 3) == 0) {
+			conditionText = rest + 3;
+		} else if (*rest) {
+			printf(TERM_BOLD_RED "Unexpected '%s'. Conditions must start with 'if'.\n" TERM_RESET, rest);
+			return;
+		}
 	}
 
 	if (address < 0 || address >= emulator.memorySize) {
 		printf(TERM_BOLD_RED "Address out of bounds.\n" TERM_RESET);
+		return;
+	}
+
+	// A condição é compilada uma única vez, aqui
+	BreakCondition* condition = NULL;
+	if (conditionText) {
+		condition = (BreakCondition*)calloc(1, sizeof(BreakCondition));
+		const char* error = exprCompile(conditionText, &condition->condition);
+		if (error) {
+			printf(TERM_BOLD_RED "Invalid condition: %s.\n" TERM_RESET, error);
+			free(condition);
+			return;
+		}
 	}
 
+	emuSetBreakpointCondition(address, condition);
 	emuSetBreakpoint(address, hits);
 
 	printf(TERM_GREEN "Breakpoint set at" TERM_YELLOW " 0x%03X.\n" TERM_RESET, address);
 }
 
+/// @brief Comando trace <address> <expr> [if <expr>] do emulador
+void cliTraceCmd() {
+	char* addressStr = strtok(NULL, " ");
+	char* rest = strtok(NULL, "");
+
+	int address = -1;
+	if (addressStr) {
+		sscanf(addressStr, "%x", &address);
+	}
+
+	if (address < 0 || address >= emulator.memorySize) {
+		printf(TERM_BOLD_RED "Address out of bounds.\n" TERM_RESET);
+		return;
+	}
+
+	if (!rest) {
+		printf("An expression must be passed to the trace command.\n");
+		return;
+	}
+
+	// Separa a expressão impressa da condição opcional
+	char* conditionText = strstr(rest, " if ");
+	if (conditionText) {
+		*conditionText = '\0';
+		conditionText += 4;
+	}
+
+	BreakCondition* condition = (BreakCondition*)calloc(1, sizeof(BreakCondition));
+	const char* error = exprCompile(rest, &condition->trace);
+	if (!error && conditionText) {
+		error = exprCompile(conditionText, &condition->condition);
+	}
+
+	if (error) {
+		printf(TERM_BOLD_RED "Invalid expression: %s.\n" TERM_RESET, error);
+		exprFree(&condition->trace);
+		free(condition);
+		return;
+	}
+
+	condition->traceText = (char*)malloc(strlen(rest) + 1);
+	strcpy(condition->traceText, rest);
+
+	emuSetBreakpointCondition(address, condition);
+	emuSetBreakpoint(address, -1);
+
+	printf(TERM_GREEN "Tracepoint set at" TERM_YELLOW " 0x%03X.\n" TERM_RESET, address);
+}
+
+/// @brief Comando watch <address> [r|w|rw|c] [hits] do emulador
+void cliWatchCmd() {
+	char* addressStr = strtok(NULL, " ");
+	char* kindStr = strtok(NULL, " ");
+	char* hitsStr = strtok(NULL, " ");
+
+	if (!addressStr) {
+		printf("An address must be passed to the watch command.\n");
+		return;
+	}
+
+	int address = -1;
+	int hits = -1;
+	uint8_t kinds = WATCH_WRITE;
+
+	sscanf(addressStr, "%x", &address);
+
+	// O tipo de acesso é opcional: "watch 100 3" observa escritas com 3 hits
+	if (kindStr && isdigit((unsigned char)kindStr[0])) {
+		hitsStr = kindStr;
+		kindStr = NULL;
+	}
+
+	if (kindStr) {
+		toLowerCase(kindStr);
+		if (strEquals(kindStr, "r")) {
+			kinds = WATCH_READ;
+		} else if (strEquals(kindStr, "w")) {
+			kinds = WATCH_WRITE;
+		} else if (strEquals(kindStr, "rw")) {
+			kinds = WATCH_READ | WATCH_WRITE;
+		} else if (strEquals(kindStr, "c")) {
+			kinds = WATCH_CHANGE;
+		} else {
+			printf(TERM_BOLD_RED "Unknown watch kind '%s'. Use r, w, rw or c.\n" TERM_RESET, kindStr);
+			return;
+		}
+	}
+
+	if (hitsStr) {
+		sscanf(hitsStr, "%i", &hits);
+	}
+
+	if (address < 0 || address >= emulator.memorySize) {
+		printf(TERM_BOLD_RED "Address out of bounds.\n" TERM_RESET);
+		return;
+	}
+
+	emuSetWatchpoint(address, kinds, hits);
+
+	printf(TERM_GREEN "Watchpoint set at" TERM_YELLOW " 0x%03X.\n" TERM_RESET, address);
+}
+
+/// @brief Comando unwatch <address> do emulador
+void cliUnwatchCmd() {
+	char* addressStr = strtok(NULL, " ");
+	int address = -1;
+
+	if (addressStr) {
+		sscanf(addressStr, "%x", &address);
+	}
+
+	if (address < 0 || address >= emulator.memorySize || !emuRemoveWatchpoint(address)) {
+		printf(TERM_BOLD_RED "No watchpoint at that address.\n" TERM_RESET);
+		return;
+	}
+
+	printf(TERM_GREEN "Watchpoint removed from" TERM_YELLOW " 0x%03X.\n" TERM_RESET, address);
+}
+
 // Imprime o disassembly das instruções desejadas
 void cliDisassemblyCmd() {
 	uint32_t address = emulator.registers->PC;
@@ -666,8 +1771,25 @@ void cliHelpCmd() {
 	printf(TERM_RESET "\n    Leaves step-through mode and lets the emulator run freely.\n    Execution will be stopped upon encountering a fault or the user\n    pressing CTRL-C.\n");
 	printf(TERM_CYAN  "\nreset");
 	printf(TERM_RESET "\n    Resets the memory state as it were in the beginning of the emulation\n    and clears all registers.\n");
-	prints("\n§6break, b§E [address] [hits]§R");
+	prints("\n§6break, b§E [address] [hits] [if <expr>]§R");
 	prints("\n    Sets or unsets a breakpoint at a memory§E address§R.\n    If no address is specified, the breakpoint will be set at the current location.\n    The optional§E hits§R parameter causes the breakpoint to be disabled\n    automatically after being hit the specified amount of times.\n");
+	prints("    With§E if <expr>§R, execution only stops when the expression is true, e.g.\n    §Eb 1A0 if A == 0 && [0x1F0] > 5§R. Expressions may use the registers A, B, C,\n    D, R, PC and PSW, the flags OV, UN, LE, EQ and GR, memory words [addr],\n    HITS (times the address was reached), C operators and decimal or 0x numbers.\n");
+	prints("\n§6trace, t§E <address> <expr> [if <expr>]§R");
+	prints("\n    Sets a tracepoint: every time the§E address§R is reached the expression is\n    printed, without stopping execution.\n");
+	prints("\n§6watch, w§E <address> [r|w|rw|c] [hits]§R");
+	prints("\n    Stops execution after an instruction reads (§Er§R), writes (§Ew§R, the default),\n    reads or writes (§Erw§R) or changes the value (§Ec§R) of the word at§E address§R.\n    The optional§E hits§R parameter works as in the break command.\n");
+	prints("\n§6unwatch§E <address>§R");
+	prints("\n    Removes the watchpoint at the given§E address§R.\n");
+	prints("\n§6back§E [amount | #instruction]§R");
+	prints("\n    Goes back in time§E amount§R of instructions (one by default), or to the\n    given§E #instruction§R count. Requires the§E --journal§R option.\n");
+	prints("\n§6reverse-continue, rc§R");
+	prints("\n    Goes back in time until the last instruction with an active breakpoint or\n    that accesses a watched address. Requires the§E --journal§R option.\n");
+	prints("\n§6save§E <file>§R");
+	prints("\n    Saves registers, memory, breakpoints, watchpoints and instruction counters\n    to a binary§E file§R. Breakpoint conditions and tracepoints are not saved.\n");
+	prints("\n§6load§E <file>§R");
+	prints("\n    Restores a state saved by the§E save§R command. The same state can be loaded\n    at startup with the§E --resume=<file>§R option.\n");
+	prints("\n§6diff§R");
+	prints("\n    Lists the memory words that differ from the initial memory, with the\n    initial and current values.\n");
 	printf(TERM_CYAN  "\nregisters, regs, r");
 	printf(TERM_RESET "\n    View the contents of all CPU registers.\n");
 	prints("\n§6memory, m, x§E <address> [words]§R");
@@ -688,27 +1810,92 @@ void emuInitialize(uint16_t* memory, int memSize) {
 	emulator.stepsLeft = 0;
 	emulator.breaking = false;
 	emulator.breakOnFaults = false;
-	vecInit(&emulator.breakpoints);
+	emulator.instructionCount = 0;
+
+	// Nenhum breakpoint configurado
+	emulator.breakpointBits = (uint64_t*)calloc((memSize + 63) / 64, sizeof(uint64_t));
+	emulator.breakpointHits = (int*)malloc(memSize * sizeof(int));
+	for (int i = 0; i < memSize; i++) {
+		emulator.breakpointHits[i] = BREAKPOINT_NONE;
+	}
+	emulator.activeBreakpoints = 0;
+	emulator.breakpointConditions = (BreakCondition**)calloc(memSize, sizeof(BreakCondition*));
+	emulator.breakpointConfirmed = false;
+	emulator.rewound = false;
+
+	// Nenhum watchpoint configurado
+	emulator.watchBits = (uint64_t*)calloc(ADDRESS_SPACE / 64, sizeof(uint64_t));
+	emulator.watchKinds = (uint8_t*)calloc(ADDRESS_SPACE, sizeof(uint8_t));
+	emulator.watchHits = (int*)malloc(ADDRESS_SPACE * sizeof(int));
+	for (int i = 0; i < ADDRESS_SPACE; i++) {
+		emulator.watchHits[i] = BREAKPOINT_NONE;
+	}
+	emulator.activeWatchpoints = 0;
 
 	// Salva uma cópia da memória passada em um "snapshot". Esse snapshot é utilizado caso
-	// o usuário realize um 'reset' no emulador
-	emulator.snapshot = (uint16_t*)malloc(memSize * sizeof(uint16_t));
-	memcpy(emulator.snapshot, memory, memSize * sizeof(uint16_t));
+	// o usuário realize um 'reset' no emulador. Uma imagem binária mapeada já traz a sua própria
+	// visão somente leitura do arquivo, sem cópia.
+	if (image.snapshot && memory == image.memory) {
+		emulator.snapshot = image.snapshot;
+	} else {
+		emulator.snapshot = (uint16_t*)malloc(memSize * sizeof(uint16_t));
+		memcpy(emulator.snapshot, memory, memSize * sizeof(uint16_t));
+	}
 
-	// Se configurado para tal, começa o emulador já no modo step-through
-	#if !DUMMY_MODE && START_IN_BREAKING_MODE
-	emulator.breaking = true;
-	#endif
+	// Vetor paralelo à memória com as instruções pré-decodificadas. A entrada extra no final é
+	// usada como sentinela de wrap-around pelo núcleo threaded
+	emulator.decoded = (Decoded*)calloc(memSize + 1, sizeof(Decoded));
+	emulator.codeMap = (uint8_t*)calloc(memSize, sizeof(uint8_t));
 
-	// Habilita a notação extendida por padrão
-	#if !DUMMY_MODE && DEFAULT_EXTENDED_NOTATION
-	extendedNotation = true;
-	#endif
+	// O código nativo do JIT não mantém o hash de memória do detector de laços
+	if (options.core == CORE_JIT && options.detectLoops) {
+		fprintf(stderr, "Loop detection is not supported by the JIT core, using the threaded core.\n");
+		options.core = CORE_THREADED;
+	}
 
-	// Se configurado como tal pelas flags, para o emulador se alguma fault for lançada
-	#if !DUMMY_MODE && BREAK_AT_FAULTS
-	emulator.breakOnFaults = true;
-	#endif
+	// Os laços do código nativo não param para publicar o estado na memória compartilhada
+	if (options.core == CORE_JIT && options.shmName) {
+		fprintf(stderr, "Shared memory export is not supported by the JIT core, using the threaded core.\n");
+		options.core = CORE_THREADED;
+	}
+
+	// O trace binário é gravado instrução a instrução pelo núcleo switch, sem superinstruções
+	if (options.record) {
+		if (options.core != CORE_SWITCH) {
+			fprintf(stderr, "Trace recording is only supported by the switch core, using it.\n");
+			options.core = CORE_SWITCH;
+		}
+		options.fusion = false;
+	}
+
+	// Sem suporte a código nativo nessa plataforma, o JIT dá lugar ao núcleo padrão
+	if (options.core == CORE_JIT && !jitInitialize()) {
+		fprintf(stderr, "JIT core not available on this platform, using the switch core.\n");
+		options.core = CORE_SWITCH;
+	}
+
+	// No modo headless e no modo dummy nenhum recurso interativo é habilitado
+	if (!options.headless && !options.dummy) {
+		// Se configurado para tal, começa o emulador já no modo step-through
+		emulator.breaking = options.breakAtStart;
+
+		// Habilita a notação extendida por padrão
+		#if DEFAULT_EXTENDED_NOTATION
+		extendedNotation = true;
+		#endif
+
+		// Se configurado como tal pelas opções, para o emulador se alguma fault for lançada
+		emulator.breakOnFaults = options.breakAtFaults;
+
+		// O diário só é mantido pelo núcleo switch
+		if (options.journal) {
+			if (options.core != CORE_SWITCH) {
+				fprintf(stderr, "Reverse execution is only supported by the switch core, using it.\n");
+				options.core = CORE_SWITCH;
+			}
+			journalInitialize(options.journal);
+		}
+	}
 
 	emuReset();
 }
@@ -719,7 +1906,7 @@ void emuReset() {
 	// Inicializa para 0 todos os registradores
 	Registers* regs = emulator.registers;
 	regs->RI = 0;
-	regs->PC = 0;
+	regs->PC = image.entryPC;
 	regs->A = 0;
 	regs->B = 0;
 	regs->C = 0;
@@ -727,8 +1914,128 @@ void emuReset() {
 	regs->R = 0;
 	regs->PSW = 0;
 
-	// Copia a memória inicial do programa para a memória principal
-	memcpy(emulator.memory, emulator.snapshot, emulator.memorySize * 2);
+	// Descarta também as flags que ainda não haviam sido aplicadas
+	LazyFlags* lazy = &emulator.lazyFlags;
+	lazy->cmpPending = lazy->ovPending = lazy->unPending = false;
+
+	// Copia a memória inicial do programa para a memória principal. Uma memória que não mudou não é
+	// escrita, para não desfazer o compartilhamento das páginas de uma imagem binária mapeada.
+	size_t memoryBytes = emulator.memorySize * sizeof(uint16_t);
+	if (memcmp(emulator.memory, emulator.snapshot, memoryBytes) != 0) {
+		memcpy(emulator.memory, emulator.snapshot, memoryBytes);
+	}
+	emuInvalidateAll();
+
+	if (options.detectLoops) emuDetectorInitialize();
+	if (journal.entries) journalClear();
+}
+
+// Executa até RUN_CHUNK_SIZE instruções através das suas entradas pré-decodificadas, no modo
+// headless. Retorna EMU_HALT no HLT, EMU_LOOP se o detector de laços encontrou uma repetição e EMU_OK
+// ao fim do bloco. A variante com RECORD grava cada instrução no trace binário (--record).
+#define EMU_DEFINE_HEADLESS_CHUNK(NAME, RECORD)                                                \
+static EmuResult NAME(void) {                                                                \
+	Registers* regs = emulator.registers;                                                    \
+                                                                                             \
+	for (int budget = RUN_CHUNK_SIZE; budget > 0; budget--) {                                \
+		/* No núcleo padrão, o estado é amostrado a cada DETECTOR_INTERVAL instruções */     \
+		if (options.detectLoops && --detector.countdown == 0) {                              \
+			detector.countdown = DETECTOR_INTERVAL;                                          \
+			if (emuDetectorSample(regs->PC)) return EMU_LOOP;                                \
+		}                                                                                    \
+                                                                                             \
+		/* Executa a instrução através da sua entrada pré-decodificada */                    \
+		uint16_t pc = regs->PC;                                                              \
+		const Decoded* d = &emulator.decoded[pc];                                            \
+		regs->RI = emulator.memory[pc];                                                      \
+		emulator.instructionCount++;                                                         \
+                                                                                             \
+		EmuResult executed = d->handler(d);                                                  \
+		if (RECORD) recorderRecord(pc, regs->RI, executed);                                  \
+		if (executed == EMU_HALT) return EMU_HALT;                                           \
+                                                                                             \
+		emuAdvance();                                                                        \
+	}                                                                                        \
+                                                                                             \
+	return EMU_OK;                                                                           \
+}
+
+EMU_DEFINE_HEADLESS_CHUNK(emuRunHeadlessChunk,         false)
+EMU_DEFINE_HEADLESS_CHUNK(emuRunHeadlessChunkRecorded, true)
+
+#undef EMU_DEFINE_HEADLESS_CHUNK
+
+// Executa o programa sem nenhuma interação, trace ou verificação de depuração. Apenas busca,
+// executa e avança até encontrar um HLT. Ao final, imprime o estado dos registradores, o número de
+// instruções executadas e o tempo gasto.
+EmuResult emuRunHeadless() {
+	double start = getTimeSeconds();
+	EmuResult result = EMU_HALT;
+
+	while (true) {
+		// Os núcleos threaded e JIT só retornam nas instruções que não executam diretamente (HLT),
+		// ou quando o detector de laços encontra uma repetição
+		if (options.core == CORE_THREADED && emuRunThreaded() == EMU_LOOP) {
+			result = EMU_LOOP;
+			break;
+		}
+		if (options.core == CORE_JIT) emuRunJit();
+
+		// O estado é publicado entre os blocos, fora do laço de cada instrução
+		if (shm.state && emulator.instructionCount >= shm.next) shmPublish();
+
+		EmuResult chunk = recorder.file ? emuRunHeadlessChunkRecorded() : emuRunHeadlessChunk();
+		if (chunk != EMU_OK) {
+			if (chunk == EMU_LOOP) result = EMU_LOOP;
+			break;
+		}
+	}
+
+	double elapsed = getTimeSeconds() - start;
+
+	// A faixa de endereços do laço é obtida executando mais uma volta dele, fora do tempo medido
+	uint16_t low, high;
+	if (result == EMU_LOOP) emuLoopRange(&low, &high);
+
+	emuDumpRegisters();
+	printf("\nInstructions: %llu\n", (unsigned long long)emulator.instructionCount);
+	printf("Elapsed: %.6f s", elapsed);
+	if (elapsed > 0) {
+		printf(" (%.2f MIPS)", emulator.instructionCount / elapsed / 1e6);
+	}
+
+	// Superinstruções executadas, se alguma foi formada
+	for (int i = 0; i < FUSION_COUNT; i++) {
+		if (emulator.fusionCounts[i] == 0) continue;
+		printf("\nFused %s: %llu", FUSION_NAMES[i], (unsigned long long)emulator.fusionCounts[i]);
+	}
+
+	if (result == EMU_LOOP) {
+		printf("\n\nCPU did not halt: non-terminating loop detected at 0x%03X-0x%03X.\n", low, high);
+	} else {
+		printf("\n\nCPU Halted.\n");
+	}
+	return result;
+}
+
+// Multiplicador do hash de memória para cada endereço (splitmix64)
+static inline uint64_t emuHashKey(uint16_t address) {
+	uint64_t z = (address + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return (z ^ (z >> 31)) | 1;
+}
+
+// Escreve um valor na memória do programa. Mantém o hash do detector de laços e invalida a
+// decodificação da palavra escrita.
+static inline void emuStore(uint16_t address, uint16_t value) {
+	uint16_t* memory = emulator.memory;
+	if (options.detectLoops) {
+		detector.memoryHash += ((uint64_t)value - memory[address]) * emuHashKey(address);
+	}
+
+	memory[address] = value;
+	emuInvalidate(address);
 }
 
 // Obtém a instrução atual apontada pelo program counter. Atualiza o registrador de instruções RI
@@ -741,8 +2048,9 @@ uint16_t emuFetch() {
 	return instruction;
 }
 
-// Avança o program counter uma instrução a frente
-void emuAdvance() {
+// Avança o program counter uma instrução a frente. Retorna EMU_FAULT se o PC deu a volta na memória
+// com a opção de falha no wrap-around.
+EmuResult emuAdvance() {
 	Registers* regs = emulator.registers;
 
 	// Incrementa o ponteiro para a próxima instrução
@@ -750,14 +2058,17 @@ void emuAdvance() {
 
 	// Se o contador de programa ultrapassou o limite da memória, reinicie-o em 0.
 	if (regs->PC >= emulator.memorySize) { 
-		#if FAULT_ON_LOOP_AROUND
-		emuFault("Program counter looped around to 0. Was program control lost?");
-		#else
-		emuWarn("Program counter looped around to 0. Was program control lost?");
-		#endif
-
 		regs->PC = 0;
-	}
+
+		if (options.faultOnWrap) {
+			emuFault("Program counter looped around to 0. Was program control lost?");
+			return EMU_FAULT;
+		}
+
+		emuWarn("Program counter looped around to 0. Was program control lost?");
+	}
+
+	return EMU_OK;
 }
 
 // Executa a instrução dada como parâmetro
@@ -790,7 +2101,7 @@ EmuResult emuExecute(uint16_t instruction) {
 		// Garante a validade do endereço de memória X
 		if (emuGuardAddress(argument)) return EMU_FAULT;
 
-		memory[argument] = regs->A;
+		emuStore(argument, regs->A);
 		break;
 	}
 
@@ -841,8 +2152,7 @@ EmuResult emuExecute(uint16_t instruction) {
 
 	// Executa uma operação aritmética.
 	case OPCODE_ARIT:
-		emuDoArit(argument);
-		break;
+		return emuDoArit(argument);
 
 	// Interrompe a execução do processador
 	case OPCODE_HLT:
@@ -857,11 +2167,29 @@ EmuResult emuExecute(uint16_t instruction) {
 	return EMU_OK;
 }
 
-// Executa uma instrução de aritmética ARIT com o argumento X completo
-void emuDoArit(uint16_t argument) {
+/// @brief Variante instrumentada de emuExecute, usada enquanto houver algum watchpoint armado.
+/// Verifica os watchpoints do endereço acessado por LDA e STA depois da execução da instrução.
+EmuResult emuExecuteWatched(uint16_t instruction) {
+	if (!emuAccessWatched(instruction)) return emuExecute(instruction);
+
+	uint16_t argument = (instruction & 0x0FFF);
+	uint8_t access = (instruction & 0xF000) >> 12 == OPCODE_LDA ? WATCH_READ : WATCH_WRITE;
+	uint16_t before = emulator.memory[argument];
+
+	EmuResult result = emuExecute(instruction);
+	if (result == EMU_OK && emuCheckWatchpoint(argument, access, before)) return EMU_BREAK;
+	return result;
+}
+
+// Executa uma instrução de aritmética ARIT com o argumento X completo. Retorna EMU_FAULT se a
+// instrução é inválida.
+EmuResult emuDoArit(uint16_t argument) {
 	Registers* regs = emulator.registers;
 	uint16_t* PSW = &emulator.registers->PSW;
 
+	// Essa implementação atualiza a PSW diretamente, então aplica antes as flags pendentes
+	emuSyncFlags();
+
 	// Extrai os 3 bits que determinam a operação aritmética a realizar
 	uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
 
@@ -878,14 +2206,14 @@ void emuDoArit(uint16_t argument) {
 	uint16_t* regDst = emuGetRegister(bitsDst);
 	if (!regDst) {
 		emuFault("Invalid arit register destination code: %i\n", bitsDst);
-		return;
+		return EMU_FAULT;
 	}
 
 	// Obtém o registrador operando usando os bits de Op1
 	uint16_t* regOp1 = emuGetRegister(bitsOp1);
 	if (!regOp1) {
 		emuFault("Invalid arit register op1 code: %i\n", bitsOp1);
-		return;
+		return EMU_FAULT;
 	}
 
 	// Obtém o registrador operando usando os bits de Op2
@@ -900,7 +2228,7 @@ void emuDoArit(uint16_t argument) {
 		regOp2 = emuGetRegister(bitsOp2 & 0b011);
 		if (!regOp2) {
 			emuFault("Invalid arit register op2 code: %i\n", bitsOp2);
-			return;
+			return EMU_FAULT;
 		}	
 	}	
 
@@ -947,7 +2275,7 @@ void emuDoArit(uint16_t argument) {
 		break;
 	default:
 		emuFault("Unimplemented arit operation %i\n", (int)bitsOpr);
-		return;
+		return EMU_FAULT;
 	}
 
 	// Compara os operandos 1 e 2 e seta os bits 13, 12 e 11 de acordo com as comparações
@@ -959,6 +2287,8 @@ void emuDoArit(uint16_t argument) {
 
 	bool greater = op1 > op2;
 	setBit(PSW, 11, greater);
+
+	return EMU_OK;
 }
 
 // Retorna o endereço do registrador correspondente ao código de 3 bits passado.
@@ -983,301 +2313,3512 @@ uint16_t* emuGetRegister(uint8_t code) {
 	return NULL;
 }
 
-// Imprime no console uma linha com o endereço e disassembly da instrução apontada pelo
-// endereço passado como argumento
-void emuPrintDisassemblyLine(uint16_t address) {
-	if (address >= emulator.memorySize) {
-		printf(TERM_BOLD_RED "Instruction address 0x%X out of bounds (0x%X)\n" TERM_RESET, address, emulator.memorySize);
-		return;
+// -- Execução de instruções pré-decodificadas
+//
+// Cada palavra da memória tem uma entrada correspondente no vetor emulator.decoded. A entrada é
+// decodificada apenas na primeira vez que é executada e guarda a função que executa aquela
+// instrução e seus operandos já resolvidos. Um STA sobre a palavra invalida apenas a entrada dela.
+
+// Rótulo do núcleo threaded que decodifica uma entrada ainda não decodificada
+static const void* threadedDecodeTarget = NULL;
+
+// Entrada ainda não decodificada: decodifica a instrução da memória e a executa
+static EmuResult emuExecDecode(const Decoded* d) {
+	uint16_t address = d - emulator.decoded;
+	emuDecode(address);
+
+	const Decoded* entry = &emulator.decoded[address];
+	return entry->handler(entry);
+}
+
+static EmuResult emuExecNop(const Decoded* d) {
+	return EMU_OK;
+}
+
+static EmuResult emuExecLda(const Decoded* d) {
+	emulator.registers->A = emulator.memory[d->argument];
+	return EMU_OK;
+}
+
+static EmuResult emuExecSta(const Decoded* d) {
+	// A palavra escrita pode ser código, emuStore descarta a decodificação anterior dela
+	emuStore(d->argument, emulator.registers->A);
+	return EMU_OK;
+}
+
+static EmuResult emuExecJmp(const Decoded* d) {
+	Registers* regs = emulator.registers;
+	regs->R = regs->PC + 1;
+	regs->PC = d->argument - 1;
+	return EMU_OK;
+}
+
+static EmuResult emuExecJnz(const Decoded* d) {
+	Registers* regs = emulator.registers;
+	if (regs->A != 0) {
+		regs->R = regs->PC + 1;
+		regs->PC = d->argument - 1;
 	}
+	return EMU_OK;
+}
 
-	// Obtém a instrução no endereço
-	uint32_t instruction = emulator.memory[address];
-					
-	// Extrai da instrução os bits do código de operação e argumento X
+static EmuResult emuExecRet(const Decoded* d) {
+	Registers* regs = emulator.registers;
+
+	// O endereço de retorno só é conhecido no momento da execução
+	if (emuGuardAddress(regs->R)) return EMU_FAULT;
+
+	uint16_t pc = regs->PC;
+	regs->PC = regs->R - 1;
+	regs->R = pc + 1;
+	return EMU_OK;
+}
+
+static EmuResult emuExecHlt(const Decoded* d) {
+	return EMU_HALT;
+}
+
+static EmuResult emuExecBad(const Decoded* d) {
+	emuBadInstruction();
+	return EMU_FAULT;
+}
+
+// LDA, STA, JMP ou JNZ com endereço fora da memória. A falha é lançada a cada execução
+static EmuResult emuExecBadAddress(const Decoded* d) {
+	emuGuardAddress(d->argument);
+	return EMU_FAULT;
+}
+
+// -- Handlers especializados de ARIT
+//
+// Cada um dos 4096 argumentos possíveis de uma ARIT tem seu próprio handler, gerado em tempo de
+// compilação pelas macros abaixo. Como o argumento é uma constante em cada handler, o compilador
+// resolve a operação, os registradores e o operando zero imediato, restando apenas as leituras,
+// a operação e a atualização da PSW. Argumentos com códigos de registrador inválidos viram
+// handlers que apenas reproduzem a falha de emuDoArit.
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// Retorna se os códigos de registrador de destino e do operando 1 da ARIT são válidos. O operando
+// 2 é sempre válido, pois usa apenas 2 bits para selecionar um registrador.
+static ALWAYS_INLINE bool emuAritIsValid(uint16_t argument) {
+	uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+	uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+	return (bitsDst & 0b110) != 0b100 && (bitsOp1 & 0b110) != 0b100;
+}
+
+// Versão de emuGetRegister para códigos constantes, resolvida em tempo de compilação
+static ALWAYS_INLINE uint16_t* emuAritRegister(Registers* r, uint8_t code) {
+	switch (code) {
+	case 0x0: return &r->A;
+	case 0x1: return &r->B;
+	case 0x2: return &r->C;
+	case 0x3: return &r->D;
+	case 0x6: return &r->R;
+	default:  return &r->PSW;
+	}
+}
+
+// Corpo comum dos handlers especializados. Deve ser chamado sempre com um argumento constante.
+static ALWAYS_INLINE EmuResult emuAritSpecialized(uint16_t argument) {
+	if (!emuAritIsValid(argument)) return emuDoArit(argument);
+
+	Registers* regs = emulator.registers;
+	uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
+	uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+	uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+	uint8_t bitsOp2 =  argument & 0b000000000111;
+
+	// Se a instrução lê ou escreve a PSW, as flags pendentes precisam ser aplicadas antes
+	bool usesPsw = bitsDst == 0b111 || bitsOp1 == 0b111;
+	if (usesPsw) emuSyncFlags();
+
+	uint16_t* dst = emuAritRegister(regs, bitsDst);
+	uint16_t op1 = *emuAritRegister(regs, bitsOp1);
+	uint16_t op2 = (bitsOp2 & 0b100) ? *emuAritRegister(regs, bitsOp2 & 0b011) : 0;
+	uint32_t sum = 0;
+
+	switch (bitsOpr) {
+	case ARIT_SET0:
+		*dst = 0x0000;
+		break;
+	case ARIT_SETF:
+		*dst = 0xFFFF;
+		break;
+	case ARIT_NOT:
+		*dst = ~op1;
+		break;
+	case ARIT_AND:
+		*dst = op1 & op2;
+		break;
+	case ARIT_OR:
+		*dst = op1 | op2;
+		break;
+	case ARIT_XOR:
+		*dst = op1 ^ op2;
+		break;
+	case ARIT_ADD:
+		sum = (uint32_t)op1 + op2;
+		*dst = (uint16_t)sum;
+		break;
+	case ARIT_SUB:
+		*dst = op1 - op2;
+		break;
+	}
+
+	// Caso comum: apenas registra o necessário para calcular as flags depois
+	LazyFlags* lazy = &emulator.lazyFlags;
+	int32_t cmp = (int32_t)op1 - (int32_t)op2;
+	lazy->cmp = cmp;
+	lazy->cmpPending = true;
+	if (bitsOpr == ARIT_ADD) {
+		lazy->sum = sum;
+		lazy->ovPending = true;
+	} else if (bitsOpr == ARIT_SUB) {
+		lazy->diff = cmp;
+		lazy->unPending = true;
+	}
+
+	// Quando a PSW é o destino, as flags são aplicadas logo em seguida sobre o resultado
+	if (bitsDst == 0b111) emuSyncFlags();
+	return EMU_OK;
+}
+
+// Expande a macro M para cada um dos 4096 argumentos, em hexadecimal de 3 dígitos
+#define ARIT_EXPAND_1(M, h) \
+	M(h##0) M(h##1) M(h##2) M(h##3) M(h##4) M(h##5) M(h##6) M(h##7) \
+	M(h##8) M(h##9) M(h##A) M(h##B) M(h##C) M(h##D) M(h##E) M(h##F)
+#define ARIT_EXPAND_2(M, h) \
+	ARIT_EXPAND_1(M, h##0) ARIT_EXPAND_1(M, h##1) ARIT_EXPAND_1(M, h##2) ARIT_EXPAND_1(M, h##3) \
+	ARIT_EXPAND_1(M, h##4) ARIT_EXPAND_1(M, h##5) ARIT_EXPAND_1(M, h##6) ARIT_EXPAND_1(M, h##7) \
+	ARIT_EXPAND_1(M, h##8) ARIT_EXPAND_1(M, h##9) ARIT_EXPAND_1(M, h##A) ARIT_EXPAND_1(M, h##B) \
+	ARIT_EXPAND_1(M, h##C) ARIT_EXPAND_1(M, h##D) ARIT_EXPAND_1(M, h##E) ARIT_EXPAND_1(M, h##F)
+#define ARIT_EXPAND(M) \
+	ARIT_EXPAND_2(M, 0) ARIT_EXPAND_2(M, 1) ARIT_EXPAND_2(M, 2) ARIT_EXPAND_2(M, 3) \
+	ARIT_EXPAND_2(M, 4) ARIT_EXPAND_2(M, 5) ARIT_EXPAND_2(M, 6) ARIT_EXPAND_2(M, 7) \
+	ARIT_EXPAND_2(M, 8) ARIT_EXPAND_2(M, 9) ARIT_EXPAND_2(M, A) ARIT_EXPAND_2(M, B) \
+	ARIT_EXPAND_2(M, C) ARIT_EXPAND_2(M, D) ARIT_EXPAND_2(M, E) ARIT_EXPAND_2(M, F)
+
+#define ARIT_DEFINE_HANDLER(h) \
+	static EmuResult emuExecArit_##h(const Decoded* d) { return emuAritSpecialized(0x##h); }
+#define ARIT_HANDLER_ENTRY(h) emuExecArit_##h,
+
+ARIT_EXPAND(ARIT_DEFINE_HANDLER)
+
+// Tabela de handlers de ARIT indexada pelo argumento de 12 bits da instrução
+static const ExecHandler ARIT_TABLE[4096] = {
+	ARIT_EXPAND(ARIT_HANDLER_ENTRY)
+};
+
+#undef ARIT_DEFINE_HANDLER
+#undef ARIT_HANDLER_ENTRY
+
+// -- Laços contados
+//
+// Um laço cujo corpo termina em "ARIT SUB A = A - r; JNZ início" e não tem outro efeito além de ARITs
+// idempotentes (que não leem A, a PSW ou registradores escritos no próprio corpo) executa sempre o
+// mesmo trabalho a cada iteração, exceto pela contagem em A. Quando o JNZ volta ao início, o número
+// de iterações restantes é calculado em forma fechada e todas menos a última são puladas de uma vez:
+// A recebe o valor que teria antes da última iteração e o contador soma as instruções puladas. A
+// última iteração é executada normalmente, deixando registradores e PSW exatos.
+
+// Maior corpo de laço contado reconhecido, em instruções
+#define LOOP_MAX_LENGTH 64
+
+/// @brief Retorna o menor k >= 1 tal que A - k * step = 0 em 16 bits, ou 0 se o laço nunca termina
+static uint32_t emuLoopIterations(uint16_t a, uint16_t step) {
+	if (step == 0) return 0;
+
+	// step = odd * 2^t. Existe solução apenas se 2^t divide A, e então k = (A / 2^t) * odd^-1
+	// módulo 2^(16 - t)
+	uint32_t power = step & -step;
+	if (a % power) return 0;
+
+	uint32_t odd = step / power;
+	uint32_t inverse = odd;
+	for (int i = 0; i < 4; i++) {
+		inverse *= 2 - odd * inverse;
+	}
+
+	uint32_t modulus = 0x10000 / power;
+	uint32_t k = ((a / power) * inverse) & (modulus - 1);
+	return k ? k : modulus;
+}
+
+/// @brief Chamada quando o JNZ no endereço dado, que fecha um laço contado, vai voltar ao início.
+/// Pula todas as iterações restantes menos a última e retorna o número de instruções puladas.
+static uint64_t emuSkipCountedLoop(uint16_t jnzAddress, uint8_t loopLength) {
+	Registers* regs = emulator.registers;
+	uint16_t sub = emulator.memory[jnzAddress - 1];
+	uint16_t step = *emuAritRegister(regs, sub & 0b011);
+
+	uint32_t remaining = emuLoopIterations(regs->A, step);
+	if (remaining <= 1) return 0;
+
+	regs->A = step;
+	return (uint64_t)(remaining - 1) * loopLength;
+}
+
+// Retorna se a ARIT dada lê o registrador de código dado
+static bool emuAritReads(uint16_t argument, uint8_t code) {
+	uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
+	uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+	uint8_t bitsOp2 =  argument & 0b000000000111;
+
+	// SET0 e SETF não dependem dos operandos
+	if (bitsOpr == ARIT_SET0 || bitsOpr == ARIT_SETF) return false;
+	if (bitsOp1 == code) return true;
+	return bitsOpr != ARIT_NOT && (bitsOp2 & 0b100) && (bitsOp2 & 0b011) == code;
+}
+
+/// @brief Verifica se o JNZ no endereço dado fecha um laço contado. Retorna o número de instruções
+/// por iteração, ou 0 se não for o caso.
+static uint8_t emuCountedLoopLength(uint16_t jnzAddress) {
+	uint16_t* memory = emulator.memory;
+	uint16_t head = memory[jnzAddress] & 0x0FFF;
+	int length = jnzAddress - head + 1;
+	if (head >= jnzAddress || length > LOOP_MAX_LENGTH) return 0;
+
+	// A última instrução antes do JNZ decrementa A por um registrador r
+	uint16_t sub = memory[jnzAddress - 1];
+	uint8_t step = sub & 0b011;
+	if (sub >> 12 != OPCODE_ARIT || (sub & 0b111111111100) != 0b111000000100 || step == 0) {
+		return 0;
+	}
+
+	// Registradores que mudam no corpo: A, a PSW e os destinos das outras ARITs, que não podem ser
+	// o próprio r nem R
+	uint8_t written = (1 << 0) | (1 << 7);
+	for (int i = head; i < jnzAddress - 1; i++) {
+		uint16_t instruction = memory[i];
+		if (instruction >> 12 == OPCODE_NOP) continue;
+		if (instruction >> 12 != OPCODE_ARIT || !emuAritIsValid(instruction & 0x0FFF)) return 0;
+
+		uint8_t bitsDst = (instruction & 0b000111000000) >> 6;
+		if (written & (1 << bitsDst) || bitsDst == step || bitsDst == 0x6) return 0;
+		written |= 1 << bitsDst;
+	}
+
+	// As ARITs do corpo não podem depender do que muda a cada iteração
+	for (int i = head; i < jnzAddress - 1; i++) {
+		uint16_t instruction = memory[i];
+		if (instruction >> 12 == OPCODE_NOP) continue;
+
+		for (int code = 0; code < 8; code++) {
+			if ((written & (1 << code)) && emuAritReads(instruction & 0x0FFF, code)) return 0;
+		}
+	}
+
+	// Breakpoints no corpo seriam pulados
+	for (int i = head; i <= jnzAddress; i++) {
+		if (emuBreakpointActive(i)) return 0;
+	}
+
+	for (int i = head; i <= jnzAddress; i++) {
+		emulator.codeMap[i] |= CODE_LOOP | CODE_DECODED;
+	}
+	return length;
+}
+
+// JNZ que fecha um laço contado
+static EmuResult emuExecLoopJnz(const Decoded* d) {
+	Registers* regs = emulator.registers;
+	if (regs->A != 0) {
+		emulator.instructionCount += emuSkipCountedLoop(regs->PC, d->loopLength);
+		regs->R = regs->PC + 1;
+		regs->PC = d->argument - 1;
+	}
+	return EMU_OK;
+}
+
+// -- Superinstruções
+//
+// Durante a pré-decodificação, sequências comuns de instruções que nunca falham são agrupadas em uma
+// única entrada, executada com um só dispatch. Ao final, PC e RI ficam na última instrução da
+// sequência, como se cada uma tivesse sido executada separadamente, e os handlers somam ao contador
+// as instruções além da primeira. As palavras seguintes continuam com suas próprias entradas para
+// saltos que caiam no meio da sequência, e modificar qualquer uma delas invalida a superinstrução.
+
+// LDA x; ARIT; STA y
+static EmuResult emuExecLdaAritSta(const Decoded* d) {
+	Registers* regs = emulator.registers;
+	uint16_t* memory = emulator.memory;
+	uint16_t address = d - emulator.decoded;
+
+	regs->A = memory[d->argument];
+	ARIT_TABLE[memory[address + 1] & 0x0FFF](d);
+
+	emuStore(d->fusedArgument, regs->A);
+	regs->PC = address + 2;
+	regs->RI = memory[address + 2];
+
+	emulator.instructionCount += 2;
+	emulator.fusionCounts[FUSION_LDA_ARIT_STA]++;
+	return EMU_OK;
+}
+
+// Parte JNZ de um SUB; JNZ, com o SUB já executado
+static ALWAYS_INLINE EmuResult emuFusedJnz(const Decoded* d) {
+	Registers* regs = emulator.registers;
+	uint16_t address = d - emulator.decoded;
+
+	regs->PC = address + 1;
+	regs->RI = emulator.memory[address + 1];
+	if (regs->A != 0) {
+		if (d->loopLength) emulator.instructionCount += emuSkipCountedLoop(address + 1, d->loopLength);
+		regs->R = address + 2;
+		regs->PC = d->fusedArgument - 1;
+	}
+
+	emulator.instructionCount += 1;
+	emulator.fusionCounts[FUSION_SUB_JNZ]++;
+	return EMU_OK;
+}
+
+// ARIT SUB; JNZ x, especializado para cada um dos 512 argumentos de SUB (0xE00 a 0xFFF), para que a
+// subtração não precise de uma segunda chamada indireta
+#define SUB_JNZ_DEFINE_HANDLER(h) \
+	static EmuResult emuExecSubJnz_##h(const Decoded* d) { \
+		emuAritSpecialized(0x##h); \
+		return emuFusedJnz(d); \
+	}
+#define SUB_JNZ_HANDLER_ENTRY(h) emuExecSubJnz_##h,
+
+ARIT_EXPAND_2(SUB_JNZ_DEFINE_HANDLER, E)
+ARIT_EXPAND_2(SUB_JNZ_DEFINE_HANDLER, F)
+
+// Tabela de handlers de SUB; JNZ indexada pelo argumento da ARIT menos 0xE00
+static const ExecHandler SUB_JNZ_TABLE[512] = {
+	ARIT_EXPAND_2(SUB_JNZ_HANDLER_ENTRY, E)
+	ARIT_EXPAND_2(SUB_JNZ_HANDLER_ENTRY, F)
+};
+
+#undef SUB_JNZ_DEFINE_HANDLER
+#undef SUB_JNZ_HANDLER_ENTRY
+
+// Retorna se a palavra no endereço dado pode ser a instrução seguinte de uma superinstrução com o
+// opcode esperado: existe, nunca falha e não tem breakpoint nem watchpoint ativo
+static bool emuFusable(uint16_t address, Opcode opcode) {
+	if (address >= emulator.memorySize) return false;
+
+	uint16_t instruction = emulator.memory[address];
+	uint16_t argument = (instruction & 0x0FFF);
+	if ((instruction & 0xF000) >> 12 != opcode) return false;
+
+	if (emuTrapActive(address)) return false;
+
+	if (opcode == OPCODE_ARIT) return emuAritIsValid(argument);
+	return argument < emulator.memorySize;
+}
+
+/// @brief Tenta formar uma superinstrução a partir da entrada já decodificada no endereço dado
+static void emuFuse(uint16_t address) {
+	Decoded* d = &emulator.decoded[address];
+
+	if (d->handler == emuExecLda && emuFusable(address + 1, OPCODE_ARIT)
+		&& emuFusable(address + 2, OPCODE_STA)) {
+		d->handler = emuExecLdaAritSta;
+		d->fusedArgument = emulator.memory[address + 2] & 0x0FFF;
+		d->length = 3;
+	} else if ((d->instruction & 0xF000) >> 12 == OPCODE_ARIT && d->argument >= 0xE00
+		&& emuAritIsValid(d->argument) && emuFusable(address + 1, OPCODE_JNZ)) {
+		d->handler = SUB_JNZ_TABLE[d->argument - 0xE00];
+		d->fusedArgument = emulator.memory[address + 1] & 0x0FFF;
+		d->length = 2;
+		d->loopLength = emuCountedLoopLength(address + 1);
+	}
+
+	// As palavras cobertas precisam avisar quando forem escritas
+	for (int i = 1; i < d->length; i++) {
+		emulator.codeMap[address + i] |= CODE_DECODED;
+	}
+}
+
+/// @brief Decodifica a instrução presente na memória no endereço dado e preenche a entrada
+/// pré-decodificada correspondente.
+void emuDecode(uint16_t address) {
+	uint16_t instruction = emulator.memory[address];
 	uint8_t opcode = (instruction & 0xF000) >> 12;
 	uint16_t argument = (instruction & 0x0FFF);
 
-	// Buffer de strings para imprimir a mensagem de uma vez só
-	StringBuffer msgBuffer;
-	stbInit(&msgBuffer);
+	Decoded* d = &emulator.decoded[address];
+	d->argument = argument;
+	d->instruction = instruction;
+	d->length = 1;
+	d->loopLength = 0;
+	emulator.codeMap[address] |= CODE_DECODED;
 
-	// Obtém o breakpoint configurado nesse endereço se houver
-	Breakpoint* bp = emuGetBreakpoint(address);
+	// Instruções com endereço imediato inválido falham sempre, independente do estado
+	bool badAddress = argument >= emulator.memorySize;
 
-	if (bp) {
-		if (bp->hits == 0) {
-			// Se houver um breakpoint desativado, imprime o endereço em roxo
-			stbAppend(&msgBuffer, "§D{%3Xh}§5 ", address);
-		} else {
-			// Se ele for ativo, imprime em vermelho
-			stbAppend(&msgBuffer, "§9{%3Xh}§1 ", address);
+	switch (opcode) {
+	case OPCODE_NOP:
+		d->handler = emuExecNop;
+		break;
+	case OPCODE_LDA:
+		d->handler = badAddress ? emuExecBadAddress : emuExecLda;
+		break;
+	case OPCODE_STA:
+		d->handler = badAddress ? emuExecBadAddress : emuExecSta;
+		break;
+	case OPCODE_JMP:
+		d->handler = badAddress ? emuExecBadAddress : emuExecJmp;
+		break;
+	case OPCODE_JNZ:
+		d->handler = badAddress ? emuExecBadAddress : emuExecJnz;
+		// Os laços contados são pulados de uma vez, sem passar por cada instrução a ser gravada
+		if (!badAddress && !options.record) {
+			d->loopLength = emuCountedLoopLength(address);
+			if (d->loopLength) d->handler = emuExecLoopJnz;
+		}
+		break;
+	case OPCODE_RET:
+		d->handler = emuExecRet;
+		break;
+	case OPCODE_HLT:
+		d->handler = emuExecHlt;
+		break;
+	case OPCODE_ARIT:
+		d->handler = ARIT_TABLE[argument];
+		break;
+	default:
+		d->handler = emuExecBad;
+		break;
+	}
+
+	if (options.fusion) emuFuse(address);
+}
+
+/// @brief Aplica na PSW as flags pendentes das últimas ARITs. Deve ser chamada antes de qualquer
+/// leitura ou escrita da PSW fora dos handlers de ARIT.
+void emuSyncFlags() {
+	LazyFlags* lazy = &emulator.lazyFlags;
+	uint16_t psw = emulator.registers->PSW;
+
+	if (lazy->ovPending) {
+		psw = (psw & ~0x8000) | ((lazy->sum > 0xFFFF) << 15);
+	}
+
+	if (lazy->unPending) {
+		psw = (psw & ~0x4000) | ((lazy->diff < 0) << 14);
+	}
+
+	if (lazy->cmpPending) {
+		int32_t cmp = lazy->cmp;
+		psw = (psw & ~0x3800) | ((cmp < 0) << 13) | ((cmp == 0) << 12) | ((cmp > 0) << 11);
+	}
+
+	emulator.registers->PSW = psw;
+	lazy->cmpPending = lazy->ovPending = lazy->unPending = false;
+}
+
+// Volta a entrada dada para o estado não decodificado
+static void emuResetDecoded(Decoded* d) {
+	d->handler = emuExecDecode;
+	d->target = threadedDecodeTarget;
+	d->length = 1;
+	d->loopLength = 0;
+}
+
+/// @brief Descarta a decodificação da palavra no endereço dado. Deve ser chamada sempre que a
+/// memória for modificada.
+void emuInvalidate(uint16_t address) {
+	// Nenhuma entrada depende de palavras que nunca foram decodificadas
+	uint8_t code = emulator.codeMap[address];
+	if (!code) return;
+
+	emuResetDecoded(&emulator.decoded[address]);
+
+	// Superinstruções anteriores que cobrem esse endereço também são descartadas
+	for (int i = 1; i < FUSION_MAX_LENGTH && i <= address; i++) {
+		Decoded* d = &emulator.decoded[address - i];
+		if (d->length > i) emuResetDecoded(d);
+	}
+
+	// Assim como os JNZs de laços contados cujo corpo inclui esse endereço
+	if (code & CODE_LOOP) {
+		for (int i = address; i < emulator.memorySize && i < address + LOOP_MAX_LENGTH; i++) {
+			Decoded* d = &emulator.decoded[i];
+			int end = i + d->length - 1;
+			if (d->loopLength && end - d->loopLength < address) emuResetDecoded(d);
+		}
+	}
+
+	if (code & CODE_JIT) jitInvalidate(address);
+	emulator.codeMap[address] = 0;
+}
+
+/// @brief Descarta a decodificação de toda a memória
+void emuInvalidateAll() {
+	jitInvalidateAll();
+	for (int i = 0; i < emulator.memorySize; i++) {
+		emuResetDecoded(&emulator.decoded[i]);
+		emulator.codeMap[i] = 0;
+	}
+}
+
+// -- Diário de execução reversa
+//
+// Com a opção --journal, antes de cada instrução executada pelo núcleo switch é registrado no
+// diário o que ela vai alterar. Voltar n instruções desfaz os n últimos registros. A cada
+// JOURNAL_CHECKPOINT_INTERVAL instruções também é guardado o estado completo da máquina, e voltar
+// para muito longe restaura o checkpoint anterior ao destino e reexecuta dali, o que custa no
+// máximo JOURNAL_CHECKPOINT_INTERVAL instruções. O diário tem tamanho fixo: as instruções mais
+// antigas que a sua capacidade não podem mais ser desfeitas.
+
+/// @brief Aloca o diário com espaço para o número dado de instruções e os checkpoints que as cobrem
+void journalInitialize(int capacity) {
+	journal.capacity = capacity;
+	journal.entries = (JournalEntry*)malloc(capacity * sizeof(JournalEntry));
+
+	journal.checkpointCount = capacity / JOURNAL_CHECKPOINT_INTERVAL + 1;
+	journal.checkpoints = (JournalCheckpoint*)calloc(journal.checkpointCount, sizeof(JournalCheckpoint));
+	for (int i = 0; i < journal.checkpointCount; i++) {
+		journal.checkpoints[i].memory = (uint16_t*)malloc(emulator.memorySize * sizeof(uint16_t));
+	}
+
+	journalClear();
+}
+
+/// @brief Esvazia o diário. Usado no reset do emulador.
+void journalClear() {
+	journal.position = 0;
+	journal.oldest = 0;
+	for (int i = 0; i < journal.checkpointCount; i++) {
+		journal.checkpoints[i].position = UINT64_MAX;
+	}
+}
+
+/// @brief Registra no diário o que a instrução prestes a ser executada vai alterar, guardando antes
+/// um checkpoint se for a hora.
+static inline void journalRecord(uint16_t instruction) {
+	Registers* regs = emulator.registers;
+
+	// O diário guarda a PSW já com as flags pendentes aplicadas
+	emuSyncFlags();
+
+	if (journal.position % JOURNAL_CHECKPOINT_INTERVAL == 0) {
+		uint64_t index = journal.position / JOURNAL_CHECKPOINT_INTERVAL;
+		JournalCheckpoint* checkpoint = &journal.checkpoints[index % journal.checkpointCount];
+		checkpoint->position = journal.position;
+		checkpoint->registers = *regs;
+		memcpy(checkpoint->memory, emulator.memory, emulator.memorySize * sizeof(uint16_t));
+	}
+
+	JournalEntry* entry = &journal.entries[journal.position % journal.capacity];
+	entry->PC = regs->PC;
+	entry->R = regs->R;
+	entry->PSW = regs->PSW;
+	entry->kind = JOURNAL_NONE;
+
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = instruction & 0x0FFF;
+	if (opcode == OPCODE_LDA) {
+		entry->kind = JOURNAL_REGISTER;
+		entry->reg = 0;
+		entry->value = regs->A;
+	} else if (opcode == OPCODE_ARIT) {
+		uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+		uint16_t* regDst = emuGetRegister(bitsDst);
+		if (regDst) {
+			entry->kind = JOURNAL_REGISTER;
+			entry->reg = bitsDst;
+			entry->value = *regDst;
+		}
+	} else if (opcode == OPCODE_STA && argument < emulator.memorySize) {
+		entry->kind = JOURNAL_MEMORY;
+		entry->address = argument;
+		entry->value = emulator.memory[argument];
+	}
+
+	journal.position++;
+	if (journal.position - journal.oldest > (uint64_t)journal.capacity) journal.oldest++;
+}
+
+/// @brief Coloca os registradores em um estado salvo, descartando as flags pendentes
+static void journalSetRegisters(const Registers* saved) {
+	*emulator.registers = *saved;
+
+	LazyFlags* lazy = &emulator.lazyFlags;
+	lazy->cmpPending = lazy->ovPending = lazy->unPending = false;
+}
+
+/// @brief Desfaz a última instrução registrada no diário
+static void journalUndo() {
+	Registers* regs = emulator.registers;
+	journal.position--;
+	JournalEntry* entry = &journal.entries[journal.position % journal.capacity];
+
+	if (entry->kind == JOURNAL_MEMORY) {
+		emuStore(entry->address, entry->value);
+	} else if (entry->kind == JOURNAL_REGISTER) {
+		*emuGetRegister(entry->reg) = entry->value;
+	}
+
+	Registers saved = *regs;
+	saved.PC = entry->PC;
+	saved.R = entry->R;
+	saved.PSW = entry->PSW;
+	journalSetRegisters(&saved);
+}
+
+/// @brief Restaura o checkpoint dado e reexecuta silenciosamente até a instrução target
+static void journalReplay(const JournalCheckpoint* checkpoint, uint64_t target) {
+	journalSetRegisters(&checkpoint->registers);
+	memcpy(emulator.memory, checkpoint->memory, emulator.memorySize * sizeof(uint16_t));
+	emuInvalidateAll();
+
+	journal.replaying = true;
+	for (uint64_t i = checkpoint->position; i < target; i++) {
+		emuExecute(emuFetch());
+		emuAdvance();
+	}
+	journal.replaying = false;
+	journal.position = target;
+}
+
+/// @brief Volta a máquina para o estado anterior à instrução número target, pelo caminho mais curto:
+/// desfazendo os registros do diário ou reexecutando a partir do checkpoint anterior ao destino.
+/// @return false se a instrução está fora do diário.
+bool journalSeek(uint64_t target) {
+	if (target < journal.oldest || target > journal.position) return false;
+	uint64_t distance = journal.position - target;
+
+	uint64_t index = target / JOURNAL_CHECKPOINT_INTERVAL;
+	const JournalCheckpoint* checkpoint = &journal.checkpoints[index % journal.checkpointCount];
+	bool replay = checkpoint->position == index * JOURNAL_CHECKPOINT_INTERVAL
+		&& target - checkpoint->position < distance;
+
+	if (replay) {
+		journalReplay(checkpoint, target);
+	} else {
+		while (journal.position > target) journalUndo();
+	}
+
+	emulator.instructionCount -= distance;
+	emulator.registers->RI = emulator.memory[emulator.registers->PC];
+	emulator.rewound = true;
+	return true;
+}
+
+/// @brief Retorna se, executando para frente, o depurador pararia antes da instrução no endereço.
+/// Diferente de emuBreakpointStops, não conta a passagem pelo endereço nem imprime tracepoints.
+bool journalTrapStops(uint16_t addr) {
+	if (emuAccessWatched(emulator.memory[addr])) return true;
+
+	BreakCondition* condition = emulator.breakpointConditions[addr];
+	if (!condition) return true;
+	if (condition->traceText) return false;
+	return exprEvaluate(&condition->condition, condition->reached) != 0;
+}
+
+// -- Laços de execução especializados
+//
+// Fora do modo step-through, o núcleo switch executa as instruções em um destes laços, gerados
+// pela mesma macro com cada recurso do depurador ligado ou desligado. Os recursos desligados somem
+// do código gerado. O laço é escolhido a cada vez que o emulador volta a executar livremente, pela
+// opção de trace, pelo diário, pelo trace binário e pelos breakpoints e watchpoints armados naquele
+// momento. HLT, breakpoints que param e falhas saem do laço para o caminho padrão de processa.
+//
+// As instruções são executadas em blocos de RUN_CHUNK_SIZE. O pedido de interrupção do CTRL-C só é
+// consultado entre um bloco e outro, então a execução para no máximo RUN_CHUNK_SIZE instruções
+// depois dele.
+
+#define EMU_DEFINE_RUN_LOOP(NAME, TRACE, BREAKPOINTS, WATCHPOINTS, JOURNAL, RECORD)         \
+static void NAME(void) {                                                                    \
+	Registers* regs = emulator.registers;                                                   \
+	while (!interruptPending) {                                                             \
+		if (shm.state && emulator.instructionCount >= shm.next) shmPublish();               \
+		for (int budget = RUN_CHUNK_SIZE; budget > 0; budget--) {                           \
+			uint16_t instruction = emulator.memory[regs->PC];                               \
+			if ((instruction & 0xF000) >> 12 == OPCODE_HLT) return;                         \
+			if (BREAKPOINTS && emuBreakpointActive(regs->PC) && !emuPassBreakpoint(regs->PC)) { \
+				return;                                                                     \
+			}                                                                               \
+			regs->RI = instruction;                                                         \
+			if (TRACE) uiTrace(regs->PC);                                                   \
+			if (JOURNAL) journalRecord(instruction);                                        \
+			uint16_t pc = regs->PC;                                                         \
+			EmuResult result = WATCHPOINTS                                                  \
+				? emuExecuteWatched(instruction) : emuExecute(instruction);                 \
+			emulator.instructionCount++;                                                    \
+			if (RECORD) recorderRecord(pc, instruction, result);                            \
+			if (emuAdvance() != EMU_OK) result = EMU_FAULT;                                 \
+                                                                                            \
+			/* Falhas e watchpoints disparados param logo após a instrução */               \
+			if (result != EMU_OK && emulator.breaking) return;                              \
+		}                                                                                   \
+	}                                                                                       \
+}
+
+EMU_DEFINE_RUN_LOOP(emuRunBare,                      false, false, false, false, false)
+EMU_DEFINE_RUN_LOOP(emuRunBreakpoints,               false, true,  false, false, false)
+EMU_DEFINE_RUN_LOOP(emuRunWatchpoints,               false, true,  true,  false, false)
+EMU_DEFINE_RUN_LOOP(emuRunRecorded,                  false, true,  false, false, true)
+EMU_DEFINE_RUN_LOOP(emuRunRecordedWatched,           false, true,  true,  false, true)
+EMU_DEFINE_RUN_LOOP(emuRunJournaled,                 false, true,  false, true,  false)
+EMU_DEFINE_RUN_LOOP(emuRunJournaledWatched,          false, true,  true,  true,  false)
+EMU_DEFINE_RUN_LOOP(emuRunJournaledRecorded,         false, true,  false, true,  true)
+EMU_DEFINE_RUN_LOOP(emuRunJournaledRecordedWatched,  false, true,  true,  true,  true)
+
+// Com o trace ligado a impressão de cada linha domina o custo, então os laços com trace sempre
+// passam pela execução instrumentada dos watchpoints, que sem nenhum armado custa uma consulta
+EMU_DEFINE_RUN_LOOP(emuRunTraced,                    true,  true,  true,  false, false)
+EMU_DEFINE_RUN_LOOP(emuRunTracedRecorded,            true,  true,  true,  false, true)
+EMU_DEFINE_RUN_LOOP(emuRunTracedJournaled,           true,  true,  true,  true,  false)
+EMU_DEFINE_RUN_LOOP(emuRunTracedJournaledRecorded,   true,  true,  true,  true,  true)
+
+#undef EMU_DEFINE_RUN_LOOP
+
+// Laços sem trace, indexados pelos recursos ligados: bit 0 watchpoints, bit 1 trace binário e bit 2
+// diário. Sem nenhum deles, o laço só verifica breakpoints.
+static void (*const RUN_LOOPS[])(void) = {
+	emuRunBreakpoints,       emuRunWatchpoints,
+	emuRunRecorded,          emuRunRecordedWatched,
+	emuRunJournaled,         emuRunJournaledWatched,
+	emuRunJournaledRecorded, emuRunJournaledRecordedWatched,
+};
+
+// Laços com trace, indexados da mesma forma sem o bit dos watchpoints
+static void (*const RUN_LOOPS_TRACED[])(void) = {
+	emuRunTraced,          emuRunTracedRecorded,
+	emuRunTracedJournaled, emuRunTracedJournaledRecorded,
+};
+
+/// @brief Executa livremente pelo núcleo switch, com o laço especializado que cobre apenas os
+/// recursos do depurador em uso
+void emuRunSwitch() {
+	int features = (emulator.activeWatchpoints > 0) | (recorder.file != NULL) << 1
+		| (journal.entries != NULL) << 2;
+
+	if (options.trace) {
+		RUN_LOOPS_TRACED[features >> 1]();
+	} else if (features || emulator.activeBreakpoints) {
+		RUN_LOOPS[features]();
+	} else {
+		emuRunBare();
+	}
+}
+
+// -- Núcleo threaded
+//
+// Nesse núcleo cada entrada pré-decodificada guarda também o endereço do rótulo que a executa
+// (computed goto, extensão do GCC/Clang). Ao fim de cada instrução o código salta diretamente para
+// o rótulo da próxima, sem voltar ao loop de processa. O estado do depurador só é verificado nas
+// fronteiras de bloco (saltos tomados, RET, falhas e wrap-around) e em instruções marcadas com
+// breakpoint, que ficam decodificadas como uma armadilha que devolve o controle ao chamador.
+
+/// @brief Executa o programa livremente pelo núcleo threaded a partir do PC atual.
+/// Retorna sem executar a instrução em PC quando ela possui um breakpoint ativo ou é um HLT, ou
+/// quando o emulador entra em modo step-through (falha ou CTRL-C). Retorna EMU_LOOP se o detector de
+/// laços encontrou uma repetição.
+EmuResult emuRunThreaded() {
+#if defined(__GNUC__)
+	// Rótulos das instruções simples, indexados pelo handler do decodificador
+	static const struct { ExecHandler handler; const void* target; } TARGETS[] = {
+		{ emuExecNop,  &&opNop },
+		{ emuExecLda,  &&opLda },
+		{ emuExecSta,  &&opSta },
+		{ emuExecJmp,  &&opJmp },
+		{ emuExecJnz,  &&opJnz },
+		{ emuExecHlt,  &&opTrap },
+	};
+
+	Registers* regs = emulator.registers;
+	uint16_t* memory = emulator.memory;
+	Decoded* decoded = emulator.decoded;
+	uint64_t count = 0;
+	EmuResult result = EMU_OK;
+
+	// Na primeira execução, registra o rótulo de decodificação e invalida toda a memória para que
+	// todas as entradas passem a ter um rótulo válido
+	if (threadedDecodeTarget != &&decode) {
+		threadedDecodeTarget = &&decode;
+		emuInvalidateAll();
+	}
+	decoded[emulator.memorySize].target = &&wrap;
+
+	Decoded* d = &decoded[regs->PC];
+	goto *d->target;
+
+// Avança para a próxima instrução sequencial
+#define NEXT() do { d++; goto *d->target; } while (0)
+
+decode: {
+	uint16_t address = d - decoded;
+	emuDecode(address);
+
+	// Instruções com um breakpoint ativo ou que acessam um endereço observado devolvem o controle
+	// ao chamador antes de executar
+	if (emuTrapActive(address)) {
+		d->target = &&opTrap;
+		goto opTrap;
+	}
+
+	// Superinstruções têm rótulos próprios
+	if (d->handler == emuExecLdaAritSta) {
+		d->target = &&opLdaAritSta;
+		goto opLdaAritSta;
+	}
+	if (d->length == 2) {
+		d->target = &&opSubJnz;
+		goto opSubJnz;
+	}
+
+	// ARITs válidas executam o handler especializado sem sincronizar PC, já que não podem falhar
+	if ((d->instruction & 0xF000) >> 12 == OPCODE_ARIT && emuAritIsValid(d->argument)) {
+		d->target = &&opArit;
+		goto opArit;
+	}
+
+	// Instruções sem rótulo próprio (RET e falhas) são executadas pelo handler
+	d->target = &&opCall;
+	for (int i = 0; i < sizeof(TARGETS) / sizeof(TARGETS[0]); i++) {
+		if (TARGETS[i].handler == d->handler) {
+			d->target = TARGETS[i].target;
+			break;
+		}
+	}
+	goto *d->target;
+}
+
+opNop:
+	count++;
+	NEXT();
+
+opLda:
+	count++;
+	emuExecLda(d);
+	NEXT();
+
+opSta:
+	count++;
+	emuExecSta(d);
+	NEXT();
+
+opJmp:
+	count++;
+	regs->R = (d - decoded) + 1;
+	d = &decoded[d->argument];
+	goto boundary;
+
+opJnz:
+	count++;
+	if (regs->A != 0) {
+		regs->R = (d - decoded) + 1;
+		d = &decoded[d->argument];
+		goto boundary;
+	}
+	NEXT();
+
+opArit:
+	count++;
+	d->handler(d);
+	NEXT();
+
+opLdaAritSta: {
+	count += 3;
+	emulator.fusionCounts[FUSION_LDA_ARIT_STA]++;
+	regs->A = memory[d->argument];
+	ARIT_TABLE[memory[(d - decoded) + 1] & 0x0FFF](d);
+	emuStore(d->fusedArgument, regs->A);
+	d += 3;
+	goto *d->target;
+}
+
+opSubJnz:
+	count += 2;
+	emulator.fusionCounts[FUSION_SUB_JNZ]++;
+	ARIT_TABLE[d->argument](d);
+	if (regs->A != 0) {
+		uint16_t address = d - decoded;
+		if (d->loopLength) count += emuSkipCountedLoop(address + 1, d->loopLength);
+		regs->R = address + 2;
+		d = &decoded[d->fusedArgument];
+		goto boundary;
+	}
+	d += 2;
+	goto *d->target;
+
+// Executa a instrução pelo handler com PC e RI sincronizados, como no núcleo padrão
+opCall:
+	count++;
+	regs->PC = d - decoded;
+	regs->RI = d->instruction;
+	d->handler(d);
+	d = &decoded[(uint16_t)(regs->PC + 1)];
+	goto boundary;
+
+// O PC passou do fim da memória. Deixa emuAdvance lançar a falha ou o aviso e reiniciar o PC
+wrap:
+	regs->PC = emulator.memorySize - 1;
+	emuAdvance();
+	d = &decoded[regs->PC];
+	goto boundary;
+
+boundary:
+	if (emulator.breaking || interruptPending) goto leave;
+
+	// O estado publicado na memória compartilhada é atualizado nas fronteiras de bloco
+	if (shm.state && emulator.instructionCount + count >= shm.next) {
+		emulator.instructionCount += count;
+		count = 0;
+		regs->PC = d - decoded;
+		shmPublish();
+	}
+
+	// O detector de laços amostra o estado a cada fronteira de bloco
+	if (options.detectLoops) {
+		regs->PC = d - decoded;
+		if (emuDetectorSample(regs->PC)) {
+			result = EMU_LOOP;
+			goto leave;
+		}
+	}
+	goto *d->target;
+
+#undef NEXT
+
+// Breakpoints condicionais com a condição falsa e tracepoints não param a execução: a instrução é
+// executada pelo caminho padrão sem sair do núcleo
+opTrap:
+	if (emuPassBreakpoint(d - decoded)) {
+		count++;
+		regs->PC = d - decoded;
+		regs->RI = d->instruction;
+		emuExecute(d->instruction);
+		d = &decoded[(uint16_t)(regs->PC + 1)];
+		goto boundary;
+	}
+
+leave:
+	regs->PC = d - decoded;
+	emulator.instructionCount += count;
+	return result;
+#else
+	// Sem computed goto, o núcleo threaded não está disponível e o chamador executa tudo
+	return EMU_OK;
+#endif
+}
+
+// -- Núcleo JIT (x86-64)
+//
+// Traduz blocos básicos do programa emulado para código nativo x86-64. Um bloco é a sequência de
+// instruções a partir de um endereço até o primeiro JMP, JNZ ou RET (inclusive), limitada a
+// JIT_MAX_BLOCK instruções. A tradução para antes de qualquer instrução que o código nativo não
+// reproduz (HLT, instruções inválidas, endereços fora da memória, ARIT com registradores
+// inválidos e breakpoints ativos); essas seguem pelo caminho padrão de emuExecute.
+//
+// O código gerado guarda na memória do emulador os registradores e as flags pendentes exatamente
+// como os handlers pré-decodificados. Os blocos ficam em um cache indexado pelo PC de início.
+// Todo STA nativo consulta emulator.codeMap e, se escreveu sobre código já decodificado ou
+// traduzido, sai do bloco para que a palavra seja invalidada por emuInvalidate.
+
+#define JIT_MAX_BLOCK 64
+#define JIT_ARENA_SIZE (4 * 1024 * 1024)
+#define JIT_MAX_BLOCK_BYTES 8192
+
+/// @brief Código nativo de um bloco. Retorna o número de instruções emuladas executadas.
+typedef uint64_t (*JitCode)(void);
+
+/// @brief Bloco traduzido, começando em start e cobrindo length palavras
+typedef struct {
+	JitCode code;
+	uint16_t start;
+	uint16_t length;
+} JitBlock;
+
+// Estado do JIT
+static struct {
+	uint8_t* arena;
+	size_t used;
+	JitBlock** blocks;
+
+	// Escritos pelo código nativo ao sair do bloco. smcAddress é o endereço escrito por um STA
+	// sobre código (-1 se nenhum) e fallback indica que a próxima instrução deve ser executada
+	// pelo caminho padrão (RET com endereço de retorno inválido).
+	int32_t smcAddress;
+	uint8_t fallback;
+} jit;
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+// Registradores x86-64 usados pelo gerador
+enum {
+	X_RAX = 0, X_RCX = 1, X_RDX = 2, X_RBX = 3, X_RSP = 4, X_RBP = 5, X_RSI = 6, X_RDI = 7,
+	X_R8 = 8, X_R9, X_R10, X_R11, X_R12, X_R13, X_R14, X_R15
+};
+
+// Durante o bloco: RBX aponta para os registradores emulados, R12 para a memória, R13 para as
+// flags pendentes, R14 para o mapa de código e R15 acumula as instruções executadas
+#define J_REGS  X_RBX
+#define J_MEM   X_R12
+#define J_LAZY  X_R13
+#define J_CODE  X_R14
+#define J_COUNT X_R15
+
+// Ponteiro de escrita do gerador
+static uint8_t* jitOut;
+
+static void jitByte(uint8_t b) {
+	*jitOut++ = b;
+}
+
+static void jitDword(uint32_t v) {
+	memcpy(jitOut, &v, 4);
+	jitOut += 4;
+}
+
+static void jitQword(uint64_t v) {
+	memcpy(jitOut, &v, 8);
+	jitOut += 8;
+}
+
+// Prefixo REX, emitido apenas quando necessário
+static void jitRex(bool wide, int reg, int base) {
+	uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+	if (rex != 0x40) jitByte(rex);
+}
+
+// Operando de memória [base + disp32] com o campo reg do ModRM
+static void jitMem(int reg, int base, int32_t disp) {
+	jitByte(0x80 | ((reg & 7) << 3) | (base & 7));
+	if ((base & 7) == X_RSP) jitByte(0x24);
+	jitDword(disp);
+}
+
+// Operando registrador-registrador do ModRM
+static void jitRegReg(int reg, int rm) {
+	jitByte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// movzx r32, word [base + disp]
+static void jitLoad16(int dst, int base, int32_t disp) {
+	jitRex(false, dst, base);
+	jitByte(0x0F); jitByte(0xB7);
+	jitMem(dst, base, disp);
+}
+
+// mov word [base + disp], r16
+static void jitStore16(int base, int32_t disp, int src) {
+	jitByte(0x66);
+	jitRex(false, src, base);
+	jitByte(0x89);
+	jitMem(src, base, disp);
+}
+
+// mov dword [base + disp], r32
+static void jitStore32(int base, int32_t disp, int src) {
+	jitRex(false, src, base);
+	jitByte(0x89);
+	jitMem(src, base, disp);
+}
+
+// mov word [base + disp], imm16
+static void jitStoreImm16(int base, int32_t disp, uint16_t imm) {
+	jitByte(0x66);
+	jitRex(false, 0, base);
+	jitByte(0xC7);
+	jitMem(0, base, disp);
+	jitByte(imm & 0xFF); jitByte(imm >> 8);
+}
+
+// mov dword [base + disp], imm32
+static void jitStoreImm32(int base, int32_t disp, uint32_t imm) {
+	jitRex(false, 0, base);
+	jitByte(0xC7);
+	jitMem(0, base, disp);
+	jitDword(imm);
+}
+
+// mov byte [base + disp], imm8
+static void jitStoreImm8(int base, int32_t disp, uint8_t imm) {
+	jitRex(false, 0, base);
+	jitByte(0xC6);
+	jitMem(0, base, disp);
+	jitByte(imm);
+}
+
+// cmp byte [base + disp], imm8
+static void jitCmpMem8(int base, int32_t disp, uint8_t imm) {
+	jitRex(false, 7, base);
+	jitByte(0x80);
+	jitMem(7, base, disp);
+	jitByte(imm);
+}
+
+// cmp word [base + disp], imm8
+static void jitCmpMem16(int base, int32_t disp, int8_t imm) {
+	jitByte(0x66);
+	jitRex(false, 7, base);
+	jitByte(0x83);
+	jitMem(7, base, disp);
+	jitByte(imm);
+}
+
+// cmp r32, imm32
+static void jitCmpImm32(int reg, uint32_t imm) {
+	jitRex(false, 0, reg);
+	jitByte(0x81);
+	jitRegReg(7, reg);
+	jitDword(imm);
+}
+
+// mov r64, imm64
+static void jitMovImm64(int reg, uint64_t imm) {
+	jitRex(true, 0, reg);
+	jitByte(0xB8 + (reg & 7));
+	jitQword(imm);
+}
+
+// mov r32, imm32
+static void jitMovImm32(int reg, uint32_t imm) {
+	jitRex(false, 0, reg);
+	jitByte(0xB8 + (reg & 7));
+	jitDword(imm);
+}
+
+// Operação aritmética entre registradores de 32 bits: dst = dst op src. O opcode é o da forma
+// "r/m32, r32" (ADD 01, OR 09, AND 21, SUB 29, XOR 31, MOV 89)
+static void jitAlu32(uint8_t op, int dst, int src) {
+	jitRex(false, src, dst);
+	jitByte(op);
+	jitRegReg(src, dst);
+}
+
+// add r64, imm32
+static void jitAddImm64(int reg, int32_t imm) {
+	jitRex(true, 0, reg);
+	jitByte(0x81);
+	jitRegReg(0, reg);
+	jitDword(imm);
+}
+
+static void jitPush(int reg) {
+	jitRex(false, 0, reg);
+	jitByte(0x50 + (reg & 7));
+}
+
+static void jitPop(int reg) {
+	jitRex(false, 0, reg);
+	jitByte(0x58 + (reg & 7));
+}
+
+// Salto condicional com deslocamento de 32 bits a ser corrigido depois. Retorna a posição do
+// deslocamento para jitPatch.
+static uint8_t* jitJcc(uint8_t cc) {
+	jitByte(0x0F); jitByte(0x80 | cc);
+	uint8_t* patch = jitOut;
+	jitDword(0);
+	return patch;
+}
+
+// Faz o salto emitido em patch apontar para a posição atual
+static void jitPatch(uint8_t* patch) {
+	int32_t rel = (int32_t)(jitOut - (patch + 4));
+	memcpy(patch, &rel, 4);
+}
+
+#define JCC_E  0x4
+#define JCC_NE 0x5
+#define JCC_AE 0x3
+
+// Deslocamento de um registrador emulado na estrutura Registers pelo seu código de 3 bits
+static int32_t jitRegisterOffset(uint8_t code) {
+	switch (code) {
+	case 0x0: return offsetof(Registers, A);
+	case 0x1: return offsetof(Registers, B);
+	case 0x2: return offsetof(Registers, C);
+	case 0x3: return offsetof(Registers, D);
+	case 0x6: return offsetof(Registers, R);
+	default:  return offsetof(Registers, PSW);
+	}
+}
+
+// Sai do bloco retornando o número de instruções executadas. O PC já deve estar salvo.
+static void jitEmitReturn() {
+	jitRex(true, J_COUNT, X_RAX);
+	jitByte(0x89);
+	jitRegReg(J_COUNT, X_RAX);
+	jitPop(X_R15); jitPop(X_R14); jitPop(X_R13); jitPop(X_R12); jitPop(X_RBX);
+	jitByte(0xC3);
+}
+
+// Sai do bloco com o PC dado, contabilizando count instruções dessa passagem
+static void jitEmitExit(uint16_t pc, int count) {
+	jitStoreImm16(J_REGS, offsetof(Registers, PC), pc);
+	if (count) jitAddImm64(J_COUNT, count);
+	jitEmitReturn();
+}
+
+// Salto para o início do próprio bloco. O laço continua no código nativo enquanto o emulador
+// não for interrompido (CTRL-C ou falha)
+static void jitEmitBackEdge(uint16_t start, int count, uint8_t* loopTop) {
+	jitStoreImm16(J_REGS, offsetof(Registers, PC), start);
+	jitAddImm64(J_COUNT, count);
+	jitMovImm64(X_R11, (uint64_t)(uintptr_t)&emulator.breaking);
+	jitCmpMem8(X_R11, 0, 0);
+	uint8_t* stop = jitJcc(JCC_NE);
+
+	// O pedido de interrupção vale 0 ou 1, então basta comparar o byte menos significativo
+	jitMovImm64(X_R11, (uint64_t)(uintptr_t)&interruptPending);
+	jitCmpMem8(X_R11, 0, 0);
+	uint8_t* interrupted = jitJcc(JCC_NE);
+
+	jitByte(0xE9);
+	jitDword((int32_t)(loopTop - (jitOut + 4)));
+
+	jitPatch(stop);
+	jitPatch(interrupted);
+	jitEmitReturn();
+}
+
+// ARIT com argumento válido que não lê nem escreve a PSW
+static void jitEmitArit(uint16_t argument) {
+	uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
+	uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+	uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+	uint8_t bitsOp2 =  argument & 0b000000000111;
+
+	// EAX = op1, ECX = op2, EDX = resultado
+	jitLoad16(X_RAX, J_REGS, jitRegisterOffset(bitsOp1));
+	if (bitsOp2 & 0b100) {
+		jitLoad16(X_RCX, J_REGS, jitRegisterOffset(bitsOp2 & 0b011));
+	} else {
+		jitAlu32(0x31, X_RCX, X_RCX);
+	}
+
+	switch (bitsOpr) {
+	case ARIT_SET0:
+		jitAlu32(0x31, X_RDX, X_RDX);
+		break;
+	case ARIT_SETF:
+		jitMovImm32(X_RDX, 0xFFFF);
+		break;
+	case ARIT_NOT:
+		jitAlu32(0x89, X_RDX, X_RAX);
+		jitByte(0xF7); jitRegReg(2, X_RDX);
+		break;
+	case ARIT_AND:
+		jitAlu32(0x89, X_RDX, X_RAX);
+		jitAlu32(0x21, X_RDX, X_RCX);
+		break;
+	case ARIT_OR:
+		jitAlu32(0x89, X_RDX, X_RAX);
+		jitAlu32(0x09, X_RDX, X_RCX);
+		break;
+	case ARIT_XOR:
+		jitAlu32(0x89, X_RDX, X_RAX);
+		jitAlu32(0x31, X_RDX, X_RCX);
+		break;
+	case ARIT_ADD:
+		jitAlu32(0x89, X_RDX, X_RAX);
+		jitAlu32(0x01, X_RDX, X_RCX);
+		break;
+	case ARIT_SUB:
+		jitAlu32(0x89, X_RDX, X_RAX);
+		jitAlu32(0x29, X_RDX, X_RCX);
+		break;
+	}
+	jitStore16(J_REGS, jitRegisterOffset(bitsDst), X_RDX);
+
+	// Flags pendentes, como em emuAritSpecialized: R11 = op1 - op2
+	jitAlu32(0x89, X_R11, X_RAX);
+	jitAlu32(0x29, X_R11, X_RCX);
+	jitStore32(J_LAZY, offsetof(LazyFlags, cmp), X_R11);
+	jitStoreImm8(J_LAZY, offsetof(LazyFlags, cmpPending), 1);
+
+	if (bitsOpr == ARIT_ADD) {
+		jitStore32(J_LAZY, offsetof(LazyFlags, sum), X_RDX);
+		jitStoreImm8(J_LAZY, offsetof(LazyFlags, ovPending), 1);
+	} else if (bitsOpr == ARIT_SUB) {
+		jitStore32(J_LAZY, offsetof(LazyFlags, diff), X_R11);
+		jitStoreImm8(J_LAZY, offsetof(LazyFlags, unPending), 1);
+	}
+}
+
+// Retorna se a instrução no endereço dado pode fazer parte de um bloco traduzido
+static bool jitCanTranslate(uint16_t address) {
+	uint16_t instruction = emulator.memory[address];
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = (instruction & 0x0FFF);
+
+	if (emuTrapActive(address)) return false;
+
+	switch (opcode) {
+	case OPCODE_NOP:
+	case OPCODE_RET:
+		return true;
+	case OPCODE_LDA:
+	case OPCODE_STA:
+	case OPCODE_JMP:
+	case OPCODE_JNZ:
+		return argument < emulator.memorySize;
+	case OPCODE_ARIT:
+		return emuAritIsValid(argument);
+	default:
+		return false;
+	}
+}
+
+// Esvazia o cache de blocos e libera toda a arena de código
+static void jitFlush() {
+	for (int i = 0; i < emulator.memorySize; i++) {
+		free(jit.blocks[i]);
+		jit.blocks[i] = NULL;
+		emulator.codeMap[i] &= ~CODE_JIT;
+	}
+	jit.used = 0;
+}
+
+/// @brief Traduz o bloco que começa no endereço dado. Retorna NULL se nem a primeira instrução
+/// puder ser traduzida.
+static JitBlock* jitCompile(uint16_t start) {
+	if (!jitCanTranslate(start)) return NULL;
+
+	if (jit.used + JIT_MAX_BLOCK_BYTES > JIT_ARENA_SIZE) jitFlush();
+
+	// A arena fica executável e somente leitura fora da tradução (W^X)
+	mprotect(jit.arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE);
+
+	uint8_t* entry = jit.arena + jit.used;
+	jitOut = entry;
+
+	jitPush(X_RBX); jitPush(X_R12); jitPush(X_R13); jitPush(X_R14); jitPush(X_R15);
+	jitMovImm64(J_REGS, (uint64_t)(uintptr_t)emulator.registers);
+	jitMovImm64(J_MEM, (uint64_t)(uintptr_t)emulator.memory);
+	jitMovImm64(J_LAZY, (uint64_t)(uintptr_t)&emulator.lazyFlags);
+	jitMovImm64(J_CODE, (uint64_t)(uintptr_t)emulator.codeMap);
+	jitAlu32(0x31, J_COUNT, J_COUNT);
+	uint8_t* loopTop = jitOut;
+
+	int length = 0;
+	bool ended = false;
+	uint16_t address = start;
+	while (!ended && length < JIT_MAX_BLOCK && address < emulator.memorySize) {
+		if (length > 0 && !jitCanTranslate(address)) break;
+
+		uint16_t instruction = emulator.memory[address];
+		uint8_t opcode = (instruction & 0xF000) >> 12;
+		uint16_t argument = (instruction & 0x0FFF);
+		int count = ++length;
+
+		switch (opcode) {
+		case OPCODE_NOP:
+			break;
+
+		case OPCODE_LDA:
+			jitLoad16(X_RAX, J_MEM, argument * 2);
+			jitStore16(J_REGS, offsetof(Registers, A), X_RAX);
+			break;
+
+		case OPCODE_STA: {
+			jitLoad16(X_RAX, J_REGS, offsetof(Registers, A));
+			jitStore16(J_MEM, argument * 2, X_RAX);
+
+			// Escrita sobre código: avisa o endereço e sai logo após o STA
+			jitCmpMem8(J_CODE, argument, 0);
+			uint8_t* skip = jitJcc(JCC_E);
+			jitMovImm64(X_R11, (uint64_t)(uintptr_t)&jit.smcAddress);
+			jitStoreImm32(X_R11, 0, argument);
+			jitEmitExit(address + 1, count);
+			jitPatch(skip);
+			break;
+		}
+
+		case OPCODE_JMP:
+			jitStoreImm16(J_REGS, offsetof(Registers, R), address + 1);
+			if (argument == start) {
+				jitEmitBackEdge(start, count, loopTop);
+			} else {
+				jitEmitExit(argument, count);
+			}
+			ended = true;
+			break;
+
+		case OPCODE_JNZ: {
+			jitCmpMem16(J_REGS, offsetof(Registers, A), 0);
+			uint8_t* notTaken = jitJcc(JCC_E);
+			jitStoreImm16(J_REGS, offsetof(Registers, R), address + 1);
+			if (argument == start) {
+				jitEmitBackEdge(start, count, loopTop);
+			} else {
+				jitEmitExit(argument, count);
+			}
+			jitPatch(notTaken);
+			jitEmitExit(address + 1, count);
+			ended = true;
+			break;
+		}
+
+		case OPCODE_RET: {
+			// Endereço de retorno inválido: sai antes do RET para que ele falhe pelo caminho padrão
+			jitLoad16(X_RAX, J_REGS, offsetof(Registers, R));
+			jitCmpImm32(X_RAX, emulator.memorySize);
+			uint8_t* bad = jitJcc(JCC_AE);
+			jitStore16(J_REGS, offsetof(Registers, PC), X_RAX);
+			jitStoreImm16(J_REGS, offsetof(Registers, R), address + 1);
+			jitAddImm64(J_COUNT, count);
+			jitEmitReturn();
+
+			jitPatch(bad);
+			jitMovImm64(X_R11, (uint64_t)(uintptr_t)&jit.fallback);
+			jitStoreImm8(X_R11, 0, 1);
+			jitEmitExit(address, count - 1);
+			ended = true;
+			break;
+		}
+
+		case OPCODE_ARIT: {
+			uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+			uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+
+			// ARITs sobre a PSW chamam o handler especializado, que sincroniza as flags
+			if (bitsDst == 0b111 || bitsOp1 == 0b111) {
+				jitMovImm64(X_RAX, (uint64_t)(uintptr_t)ARIT_TABLE[argument]);
+				jitAlu32(0x31, X_RDI, X_RDI);
+				jitByte(0xFF); jitRegReg(2, X_RAX);
+			} else {
+				jitEmitArit(argument);
+			}
+			break;
+		}
+		}
+
+		address++;
+	}
+
+	// Bloco sem salto no final: segue para a instrução seguinte. Se ela estiver fora da memória,
+	// o wrap-around é tratado por emuRunJit.
+	if (!ended) {
+		jitEmitExit(address, length);
+	}
+
+	jit.used += jitOut - entry;
+	jit.used = (jit.used + 15) & ~(size_t)15;
+	mprotect(jit.arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC);
+
+	JitBlock* block = (JitBlock*)malloc(sizeof(JitBlock));
+	block->code = (JitCode)(uintptr_t)entry;
+	block->start = start;
+	block->length = length;
+	jit.blocks[start] = block;
+
+	for (int i = start; i < start + length; i++) {
+		emulator.codeMap[i] |= CODE_JIT;
+	}
+
+	return block;
+}
+
+/// @brief Inicializa o JIT. Retorna falso se não for possível alocar a memória executável.
+bool jitInitialize() {
+	void* arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED) return false;
+
+	jit.arena = (uint8_t*)arena;
+	jit.used = 0;
+	jit.blocks = (JitBlock**)calloc(emulator.memorySize, sizeof(JitBlock*));
+	jit.smcAddress = -1;
+	jit.fallback = 0;
+	return true;
+}
+
+/// @brief Descarta os blocos traduzidos que cobrem o endereço dado
+void jitInvalidate(uint16_t address) {
+	if (!jit.blocks) return;
+
+	int first = address - JIT_MAX_BLOCK + 1;
+	if (first < 0) first = 0;
+
+	for (int i = first; i <= address; i++) {
+		JitBlock* block = jit.blocks[i];
+		if (block && i + block->length > address) {
+			free(block);
+			jit.blocks[i] = NULL;
+		}
+	}
+}
+
+/// @brief Descarta todos os blocos traduzidos
+void jitInvalidateAll() {
+	if (jit.blocks) jitFlush();
+}
+
+/// @brief Executa o programa livremente pelo núcleo JIT a partir do PC atual. Assim como
+/// emuRunThreaded, retorna sem executar a instrução em PC quando ela é um HLT ou tem um breakpoint
+/// ativo, ou quando o emulador entra em modo step-through.
+EmuResult emuRunJit() {
+	Registers* regs = emulator.registers;
+
+	while (!emulator.breaking && !interruptPending) {
+		// O último bloco terminou no fim da memória
+		if (regs->PC >= emulator.memorySize) {
+			regs->PC = emulator.memorySize - 1;
+			emuAdvance();
+			continue;
+		}
+
+		uint16_t pc = regs->PC;
+		JitBlock* block = jit.blocks[pc];
+
+		if (!block && !jit.fallback) {
+			// HLT, breakpoints e acessos a endereços observados ficam para o chamador, exceto os
+			// breakpoints condicionais que não param, executados abaixo pelo caminho padrão
+			uint8_t opcode = (emulator.memory[pc] & 0xF000) >> 12;
+			if (opcode == OPCODE_HLT || emuTrapActive(pc)) {
+				if (!emuPassBreakpoint(pc)) break;
+				jit.fallback = 1;
+			} else {
+				block = jitCompile(pc);
+			}
+		}
+
+		if (block && !jit.fallback) {
+			emulator.instructionCount += block->code();
+
+			if (jit.smcAddress >= 0) {
+				emuInvalidate(jit.smcAddress);
+				jit.smcAddress = -1;
+			}
+			continue;
+		}
+
+		// Instrução que o JIT não traduz: executa pelo caminho padrão, lançando a falha esperada
+		jit.fallback = 0;
+		uint16_t instruction = emuFetch();
+		emulator.instructionCount++;
+		emuExecute(instruction);
+		emuAdvance();
+	}
+
+	return EMU_OK;
+}
+#else
+bool jitInitialize() {
+	return false;
+}
+
+void jitInvalidate(uint16_t address) {}
+void jitInvalidateAll() {}
+
+EmuResult emuRunJit() {
+	return EMU_OK;
+}
+#endif
+
+// -- Recompilador estático (AOT)
+//
+// Traduz a imagem de memória carregada para um programa C independente. Cada endereço alcançável a
+// partir do início do programa (e dos endereços de retorno de saltos e RETs) ganha um rótulo, e
+// JMP/JNZ viram gotos diretos. RETs e qualquer outro salto para um endereço desconhecido passam
+// por um dispatch indexado pelo PC. Endereços que não foram traduzidos, instruções inválidas e
+// palavras escritas por algum STA traduzido são executados por um pequeno interpretador embutido
+// no programa gerado, que lê a instrução da memória viva. Se o interpretador escrever sobre uma
+// palavra traduzida, o programa passa a ser todo interpretado a partir dali.
+//
+// O programa gerado se comporta como o modo headless: falhas são apenas reportadas (em stderr) e a
+// execução segue até um HLT, quando a memória é escrita no formato de escreveMem.
+
+// Parte fixa do programa gerado, antes da função principal
+static const char AOT_PRELUDE[] =
+	"#include <stdio.h>\n"
+	"#include <stdint.h>\n"
+	"#include <stdarg.h>\n"
+	"\n"
+	"static inline void fault(const char* fmt, ...) {\n"
+	"\tva_list args;\n"
+	"\tva_start(args, fmt);\n"
+	"\tfputs(\"[ERR!] CPU FAULT: \", stderr);\n"
+	"\tvfprintf(stderr, fmt, args);\n"
+	"\tfputc('\\n', stderr);\n"
+	"\tva_end(args);\n"
+	"}\n"
+	"\n"
+	"static inline void warn(const char* fmt, ...) {\n"
+	"\tva_list args;\n"
+	"\tva_start(args, fmt);\n"
+	"\tfputs(\"[WRN!] \", stderr);\n"
+	"\tvfprintf(stderr, fmt, args);\n"
+	"\tfputc('\\n', stderr);\n"
+	"\tva_end(args);\n"
+	"}\n"
+	"\n"
+	"static void setFlags(uint16_t* psw, int opr, uint16_t op1, uint16_t op2) {\n"
+	"\tif (opr == 6) *psw = (*psw & ~0x8000) | (((uint32_t)op1 + op2 > 0xFFFF) << 15);\n"
+	"\tif (opr == 7) *psw = (*psw & ~0x4000) | ((op2 > op1) << 14);\n"
+	"\t*psw = (*psw & ~0x3800) | ((op1 < op2) << 13) | ((op1 == op2) << 12) | ((op1 > op2) << 11);\n"
+	"}\n"
+	"\n"
+	"// ARIT genérica do interpretador, sobre os registradores indexados pelos códigos da instrução\n"
+	"static void arit(uint16_t* r, uint16_t x) {\n"
+	"\tint opr = x >> 9, dst = (x >> 6) & 7, src1 = (x >> 3) & 7, src2 = x & 7;\n"
+	"\tif ((dst & 6) == 4) { fault(\"Invalid arit register destination code: %i\", dst); return; }\n"
+	"\tif ((src1 & 6) == 4) { fault(\"Invalid arit register op1 code: %i\", src1); return; }\n"
+	"\tuint16_t op1 = r[src1], op2 = (src2 & 4) ? r[src2 & 3] : 0;\n"
+	"\tswitch (opr) {\n"
+	"\tcase 0: r[dst] = 0x0000; break;\n"
+	"\tcase 1: r[dst] = 0xFFFF; break;\n"
+	"\tcase 2: r[dst] = ~op1; break;\n"
+	"\tcase 3: r[dst] = op1 & op2; break;\n"
+	"\tcase 4: r[dst] = op1 | op2; break;\n"
+	"\tcase 5: r[dst] = op1 ^ op2; break;\n"
+	"\tcase 6: r[dst] = op1 + op2; break;\n"
+	"\tcase 7: r[dst] = op1 - op2; break;\n"
+	"\t}\n"
+	"\tsetFlags(&r[7], opr, op1, op2);\n"
+	"}\n"
+	"\n"
+	"static void dump(FILE* out) {\n"
+	"\tfputs(\"" HEADER "\", out);\n"
+	"\tfor (int i = 0, tokens = 0; i < MEM_SIZE; ) {\n"
+	"\t\tint rep = 1;\n"
+	"\t\twhile (i + rep < MEM_SIZE && M[i + rep] == M[i]) rep++;\n"
+	"\t\tfor (int n = (rep >= 4) ? 1 : rep; n > 0; n--) {\n"
+	"\t\t\tfputc((tokens++ % 8) == 0 ? '\\n' : ' ', out);\n"
+	"\t\t\tif (rep >= 4) fprintf(out, \"%d*\", rep);\n"
+	"\t\t\tfprintf(out, \"%hx\", M[i]);\n"
+	"\t\t}\n"
+	"\t\ti += rep;\n"
+	"\t}\n"
+	"}\n"
+	"\n";
+
+// Interpretador embutido na função principal do programa gerado. Executa a instrução em pc, avança
+// como emuAdvance e volta ao dispatch.
+static const char AOT_INTERPRETER[] =
+	"interp: {\n"
+	"\tuint16_t ri = M[pc], x = ri & 0x0FFF;\n"
+	"\tswitch (ri >> 12) {\n"
+	"\tcase 0x0: break;\n"
+	"\tcase 0x1: if (x >= MEM_SIZE) { fault(BAD_ADDRESS, x, pc); break; } A = M[x]; break;\n"
+	"\tcase 0x2:\n"
+	"\t\tif (x >= MEM_SIZE) { fault(BAD_ADDRESS, x, pc); break; }\n"
+	"\t\tM[x] = A;\n"
+	"\t\tif (COMPILED[x]) interpretOnly = 1;\n"
+	"\t\tbreak;\n"
+	"\tcase 0x3: if (x >= MEM_SIZE) { fault(BAD_ADDRESS, x, pc); break; } R = pc + 1; pc = x - 1; break;\n"
+	"\tcase 0x4: if (x >= MEM_SIZE) { fault(BAD_ADDRESS, x, pc); break; } if (A) { R = pc + 1; pc = x - 1; } break;\n"
+	"\tcase 0x5: {\n"
+	"\t\tif (R >= MEM_SIZE) { fault(BAD_ADDRESS, R, pc); break; }\n"
+	"\t\tuint16_t next = pc + 1;\n"
+	"\t\tpc = R - 1;\n"
+	"\t\tR = next;\n"
+	"\t\tbreak;\n"
+	"\t}\n"
+	"\tcase 0x6: {\n"
+	"\t\tuint16_t r[8] = { A, B, C, D, 0, 0, R, PSW };\n"
+	"\t\tarit(r, x);\n"
+	"\t\tA = r[0]; B = r[1]; C = r[2]; D = r[3]; R = r[6]; PSW = r[7];\n"
+	"\t\tbreak;\n"
+	"\t}\n"
+	"\tcase 0xF: goto halt;\n"
+	"\tdefault: fault(\"Bad instruction 0x%04X at 0x%03X\", ri, pc); break;\n"
+	"\t}\n"
+	"\tgoto advance;\n"
+	"}\n"
+	"advance:\n"
+	"\tpc++;\n"
+	"\tif (pc >= MEM_SIZE) {\n"
+	"\t\twrapReport(\"Program counter looped around to 0. Was program control lost?\");\n"
+	"\t\tpc = 0;\n"
+	"\t}\n"
+	"\tgoto dispatch;\n"
+	"\n";
+
+// Nome dos registradores nas variáveis do programa gerado, indexado pelo código de 3 bits
+static const char* const AOT_REGISTERS[] = { "A", "B", "C", "D", NULL, NULL, "R", "PSW" };
+
+// Expressões C de cada operação aritmética sobre os operandos op1 e op2
+static const char* const AOT_ARIT_EXPRESSIONS[] = {
+	"0x0000", "0xFFFF", "~op1", "op1 & op2", "op1 | op2", "op1 ^ op2", "op1 + op2", "op1 - op2"
+};
+
+// Retorna se a instrução pode ser traduzida diretamente, sem nunca falhar
+static bool aotCanTranslate(uint16_t instruction) {
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = (instruction & 0x0FFF);
+
+	switch (opcode) {
+	case OPCODE_NOP:
+	case OPCODE_RET:
+	case OPCODE_HLT:
+		return true;
+	case OPCODE_LDA:
+	case OPCODE_STA:
+	case OPCODE_JMP:
+	case OPCODE_JNZ:
+		return argument < emulator.memorySize;
+	case OPCODE_ARIT:
+		return emuAritIsValid(argument);
+	default:
+		return false;
+	}
+}
+
+// Marca em reachable todos os endereços alcançáveis por fluxo estático a partir dos dados
+static void aotFindReachable(bool* reachable) {
+	int size = emulator.memorySize;
+	uint16_t* pending = (uint16_t*)malloc(size * 3 * sizeof(uint16_t));
+	int count = 0;
+
+	pending[count++] = emulator.registers->PC;
+	while (count > 0) {
+		uint16_t address = pending[--count];
+		if (address >= size || reachable[address]) continue;
+		reachable[address] = true;
+
+		uint16_t instruction = emulator.memory[address];
+		uint8_t opcode = (instruction & 0xF000) >> 12;
+		uint16_t argument = (instruction & 0x0FFF);
+		uint16_t next = (address + 1) % size;
+
+		switch (opcode) {
+		// Depois de um JMP, a instrução seguinte é um provável endereço de retorno
+		case OPCODE_JMP:
+		case OPCODE_JNZ:
+			pending[count++] = argument;
+			pending[count++] = next;
+			break;
+		case OPCODE_HLT:
+			break;
+		default:
+			pending[count++] = next;
+			break;
+		}
+	}
+
+	free(pending);
+}
+
+/// @brief Gera no arquivo dado o programa C equivalente à imagem de memória carregada
+void aotCompile(FILE* out) {
+	int size = emulator.memorySize;
+	uint16_t* memory = emulator.memory;
+
+	bool* reachable = (bool*)calloc(size, sizeof(bool));
+	bool* written = (bool*)calloc(size, sizeof(bool));
+	bool* compiled = (bool*)calloc(size, sizeof(bool));
+	aotFindReachable(reachable);
+
+	// Palavras escritas por STAs traduzidos podem mudar, então são sempre interpretadas
+	for (int i = 0; i < size; i++) {
+		uint16_t instruction = memory[i];
+		uint16_t argument = (instruction & 0x0FFF);
+		if (reachable[i] && (instruction & 0xF000) >> 12 == OPCODE_STA && argument < size) {
+			written[argument] = true;
+		}
+	}
+
+	for (int i = 0; i < size; i++) {
+		compiled[i] = reachable[i] && !written[i] && aotCanTranslate(memory[i]);
+	}
+
+	// Imagem de memória inicial e tabela de palavras traduzidas
+	fprintf(out, "// Generated by emul --aot. Do not edit.\n");
+	fprintf(out, "#define MEM_SIZE %d\n", size);
+	fprintf(out, "#define BAD_ADDRESS \"Memory access out of bounds 0x%%04X at 0x%%03X\"\n\n");
+	fprintf(out, "#include <stdint.h>\n\n");
+
+	fprintf(out, "static uint16_t M[MEM_SIZE] = {");
+	for (int i = 0; i < size; i++) {
+		if (i % 16 == 0) fprintf(out, "\n\t");
+		fprintf(out, "0x%04X,", memory[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const uint8_t COMPILED[MEM_SIZE] = {\n\t[0]=%d,", compiled[0]);
+	for (int i = 1, n = 1; i < size; i++) {
+		if (!compiled[i]) continue;
+		if (n++ % 12 == 0) fprintf(out, "\n\t");
+		fprintf(out, "[%d]=1,", i);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fputs(AOT_PRELUDE, out);
+
+	// Relato do wrap-around do PC no programa gerado, como em emuAdvance
+	fprintf(out, "#define wrapReport %s\n\n", options.faultOnWrap ? "fault" : "warn");
+
+	fprintf(out, "int main(int argc, char* argv[]) {\n");
+	fprintf(out, "\tuint16_t A = 0, B = 0, C = 0, D = 0, R = 0, PSW = 0, pc = %d;\n", emulator.registers->PC);
+	fprintf(out, "\tint interpretOnly = 0;\n");
+	fprintf(out, "\tgoto dispatch;\n\n");
+
+	// Dispatch pelo PC para os rótulos dos endereços alcançáveis
+	fprintf(out, "dispatch:\n");
+	fprintf(out, "\tif (interpretOnly) goto interp;\n");
+	fprintf(out, "\tswitch (pc) {\n");
+	for (int i = 0; i < size; i++) {
+		if (reachable[i]) fprintf(out, "\tcase %d: goto L_%d;\n", i, i);
+	}
+	fprintf(out, "\tdefault: goto interp;\n");
+	fprintf(out, "\t}\n\n");
+
+	fputs(AOT_INTERPRETER, out);
+
+	// Uma sequência de rótulos por endereço alcançável. Instruções seguidas caem naturalmente umas
+	// nas outras, e a última posição da memória dá a volta pelo interpretador.
+	for (int i = 0; i < size; i++) {
+		if (!reachable[i]) continue;
+
+		uint16_t instruction = memory[i];
+		uint8_t opcode = (instruction & 0xF000) >> 12;
+		uint16_t argument = (instruction & 0x0FFF);
+
+		fprintf(out, "L_%d:\n", i);
+		if (!compiled[i]) {
+			fprintf(out, "\tpc = %d; goto interp;\n", i);
+			continue;
+		}
+
+		switch (opcode) {
+		case OPCODE_NOP:
+			break;
+		case OPCODE_LDA:
+			fprintf(out, "\tA = M[%d];\n", argument);
+			break;
+		case OPCODE_STA:
+			fprintf(out, "\tM[%d] = A;\n", argument);
+			break;
+		case OPCODE_JMP:
+			fprintf(out, "\tR = %d; goto L_%d;\n", i + 1, argument);
+			break;
+		case OPCODE_JNZ:
+			fprintf(out, "\tif (A) { R = %d; goto L_%d; }\n", i + 1, argument);
+			break;
+		case OPCODE_RET:
+			fprintf(out, "\tif (R >= MEM_SIZE) { pc = %d; goto interp; }\n", i);
+			fprintf(out, "\tpc = R; R = %d; goto dispatch;\n", i + 1);
+			break;
+		case OPCODE_HLT:
+			fprintf(out, "\tgoto halt;\n");
+			break;
+		case OPCODE_ARIT: {
+			uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
+			uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+			uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+			uint8_t bitsOp2 =  argument & 0b000000000111;
+			const char* op2 = (bitsOp2 & 0b100) ? AOT_REGISTERS[bitsOp2 & 0b011] : "0";
+
+			fprintf(out, "\t{ uint16_t op1 = %s, op2 = %s; %s = %s; setFlags(&PSW, %d, op1, op2); }\n",
+				AOT_REGISTERS[bitsOp1], op2, AOT_REGISTERS[bitsDst], AOT_ARIT_EXPRESSIONS[bitsOpr], bitsOpr);
+			break;
+		}
+		}
+
+		// Fim da memória: o avanço e o wrap-around ficam com o interpretador
+		if (i == size - 1) {
+			fprintf(out, "\tpc = %d; goto advance;\n", i);
+		}
+	}
+
+	// Em C99 um rótulo não pode preceder uma declaração, então o código do HLT fica em um bloco
+	fprintf(out, "\nhalt:\n\t{\n");
+	fprintf(out, "\t\tFILE* out = argc > 1 ? fopen(argv[1], \"wt\") : stdout;\n");
+	fprintf(out, "\t\tif (!out) {\n");
+	fprintf(out, "\t\t\tfprintf(stderr, \"Could not open '%%s' for writing.\\n\", argv[1]);\n");
+	fprintf(out, "\t\t\treturn 1;\n");
+	fprintf(out, "\t\t}\n");
+	fprintf(out, "\t\tdump(out);\n");
+	fprintf(out, "\t\treturn 0;\n");
+	fprintf(out, "\t}\n");
+	fprintf(out, "}\n");
+
+	free(reachable);
+	free(written);
+	free(compiled);
+}
+
+// -- Detector de laços infinitos
+//
+// Como a máquina é determinística e não tem entrada, se o estado completo (registradores e memória)
+// se repetir o programa nunca vai terminar. O estado é amostrado periodicamente (a cada fronteira de
+// bloco no núcleo threaded, ou a cada DETECTOR_INTERVAL instruções no padrão) e o algoritmo de Brent
+// compara cada amostra com um estado salvo, que é substituído sempre que o número de amostras desde
+// ele chega a uma potência de 2. A memória entra na comparação por um hash mantido a cada STA, e a
+// cópia da memória do estado salvo confirma a repetição.
+
+// Obtém a impressão digital do estado atual, com o PC dado
+static Fingerprint emuFingerprint(uint16_t pc) {
+	Registers* regs = emulator.registers;
+	emuSyncFlags();
+
+	Fingerprint f;
+	memset(&f, 0, sizeof(f));
+	f.PC = pc;
+	f.A = regs->A;
+	f.B = regs->B;
+	f.C = regs->C;
+	f.D = regs->D;
+	f.R = regs->R;
+	f.PSW = regs->PSW;
+	f.memoryHash = detector.memoryHash;
+	return f;
+}
+
+/// @brief Reinicia o detector e calcula o hash da memória atual
+void emuDetectorInitialize() {
+	if (!detector.savedMemory) {
+		detector.savedMemory = (uint16_t*)malloc(emulator.memorySize * sizeof(uint16_t));
+	}
+
+	detector.memoryHash = 0;
+	for (int i = 0; i < emulator.memorySize; i++) {
+		detector.memoryHash += emulator.memory[i] * emuHashKey(i);
+	}
+
+	detector.hasSaved = false;
+	detector.lambda = 0;
+	detector.power = 1;
+	detector.countdown = DETECTOR_INTERVAL;
+}
+
+/// @brief Registra uma amostra do estado da máquina com o PC dado. Retorna verdadeiro se esse estado
+/// é uma repetição de um estado anterior.
+bool emuDetectorSample(uint16_t pc) {
+	Fingerprint f = emuFingerprint(pc);
+	size_t memoryBytes = emulator.memorySize * sizeof(uint16_t);
+
+	if (detector.hasSaved && memcmp(&f, &detector.saved, sizeof(f)) == 0
+		&& memcmp(emulator.memory, detector.savedMemory, memoryBytes) == 0) {
+		return true;
+	}
+
+	// Depois de 2^k amostras, a amostra atual passa a ser o estado salvo
+	if (!detector.hasSaved || detector.lambda == detector.power) {
+		detector.saved = f;
+		memcpy(detector.savedMemory, emulator.memory, memoryBytes);
+		detector.hasSaved = true;
+		detector.power *= 2;
+		detector.lambda = 0;
+	}
+
+	detector.lambda++;
+	return false;
+}
+
+/// @brief Com a máquina em um estado que se repete, executa uma volta completa do laço instrução a
+/// instrução e obtém o menor e o maior endereço executados. A volta não entra no contador de
+/// instruções e as falhas e avisos dela, já relatados, não são impressos de novo.
+void emuLoopRange(uint16_t* low, uint16_t* high) {
+	Registers* regs = emulator.registers;
+	Fingerprint start = emuFingerprint(regs->PC);
+	uint64_t instructionCount = emulator.instructionCount;
+	*low = *high = regs->PC;
+	journal.replaying = true;
+
+	while (true) {
+		uint16_t pc = regs->PC;
+		if (pc < *low) *low = pc;
+		if (pc > *high) *high = pc;
+
+		// Superinstruções executam as instruções seguintes também
+		const Decoded* d = &emulator.decoded[pc];
+		if (d->handler != emuExecDecode && pc + d->length - 1 > *high) *high = pc + d->length - 1;
+
+		regs->RI = emulator.memory[pc];
+		emulator.instructionCount++;
+		d->handler(d);
+		emuAdvance();
+
+		Fingerprint now = emuFingerprint(regs->PC);
+		if (memcmp(&now, &start, sizeof(now)) == 0) break;
+	}
+
+	journal.replaying = false;
+	emulator.instructionCount = instructionCount;
+}
+
+// Imprime no console uma linha com o endereço e disassembly da instrução apontada pelo
+// endereço passado como argumento
+void emuPrintDisassemblyLine(uint16_t address) {
+	if (address >= emulator.memorySize) {
+		printf(TERM_BOLD_RED "Instruction address 0x%X out of bounds (0x%X)\n" TERM_RESET, address, emulator.memorySize);
+		return;
+	}
+
+	emuWriteDisassemblyLine(address, emulator.memory[address], emulator.breakpointHits[address]);
+}
+
+/// @brief Imprime a linha de disassembly de uma instrução, com o estado do breakpoint no seu endereço
+/// (hits restantes, ou BREAKPOINT_NONE). Usada também pela thread de interface, com os valores de
+/// quando a instrução foi executada.
+void emuWriteDisassemblyLine(uint16_t address, uint16_t instruction, int breakpointHits) {
+	// Extrai da instrução os bits do código de operação e argumento X
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = (instruction & 0x0FFF);
+
+	// Buffer de strings para imprimir a mensagem de uma vez só
+	StringBuffer msgBuffer;
+	stbInit(&msgBuffer);
+
+	// Obtém o breakpoint configurado nesse endereço se houver
+	if (breakpointHits != BREAKPOINT_NONE) {
+		if (breakpointHits == 0) {
+			// Se houver um breakpoint desativado, imprime o endereço em roxo
+			stbAppend(&msgBuffer, "§D{%3Xh}§5 ", address);
+		} else {
+			// Se ele for ativo, imprime em vermelho
+			stbAppend(&msgBuffer, "§9{%3Xh}§1 ", address);
+		}
+	} else {
+		// Caso contrário, imprime em branco
+		stbAppend(&msgBuffer, "§F[%3Xh]§R ", address);
+	}
+
+	stbAppend(&msgBuffer, "%X.%03X: ", opcode, argument);
+	
+	// Transforma a instrução em string e adiciona na string da mensagem
+	StringBuffer disassembly = emuDisassembly(instruction);
+	stbAppendBuffer(&msgBuffer, &disassembly);
+	stbFree(&disassembly);
+
+	stbColorize(&msgBuffer, ENABLE_COLORS);
+	printf("%s\n" TERM_RESET, msgBuffer.array);
+	stbFree(&msgBuffer);
+}
+
+// Retorna uma string que representa o disassembly da instrução passada
+StringBuffer emuDisassembly(uint16_t instruction) {
+	// Inicializa um buffer para as strings impressas nessa função
+	StringBuffer bufferStg;
+	StringBuffer* buffer = &bufferStg;
+	stbInit(buffer);
+
+	// Extrai o opcode e o argumento X da instrução
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = (instruction & 0x0FFF);
+		
+	// Obtém o nome da instrução pelo opcode
+	const char* name = INSTRUCTION_NAMES[opcode];
+
+	// As instruções por padrão sairão em azul claro
+	stbAppend(buffer, TERM_CYAN);
+
+	switch(opcode) {
+	case OPCODE_NOP:
+		stbAppend(buffer, TERM_BOLD_BLACK "%s ", name);
+		break;
+
+	case OPCODE_LDA:
+		stbAppend(buffer, "%s [%Xh]", name, argument);
+		break;
+
+	case OPCODE_STA:
+		stbAppend(buffer, "%s [%Xh]", name, argument);
+		break;
+
+	case OPCODE_JMP:
+		stbAppend(buffer, "%s %Xh", name, argument);
+		break;
+
+	case OPCODE_JNZ:
+		stbAppend(buffer, "%s %Xh", name, argument);
+		break;
+
+	case OPCODE_RET:
+		stbAppend(buffer, "%s", name);
+		break;
+
+	case OPCODE_ARIT:
+		stbAppend(buffer, "%s ", name);
+
+		// Extração dos bits respectivamente:
+		// 3 bits que determinam a operação aritmética a realizar
+		// 3 bits que definem o registrador destino da operação
+		// 3 bits que definem o registrador do primeiro operando
+		// 3 bits que definem o registrador do segundo operando
+		uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
+		uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+		uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;	
+		uint8_t bitsOp2 =  argument & 0b000000000111;
+
+		// Se o bit mais significante do operando 2 for 0, o operando em si é o 0 imediato
+		bool op2zero = (bitsOp2 & 0b100) == 0;
+
+		if (extendedNotation) {
+			// Imprime RES = OP1 * OP2
+			stbAppend(buffer, ARIT_EXT_FMT[bitsOpr],
+				REGISTER_NAMES[bitsDst],
+				REGISTER_NAMES[bitsOp1],
+				(op2zero) ? "0" : REGISTER_NAMES[bitsOp2 & 0b011]
+			);
+		} else {
+			// Imprime em sequência OPERAÇÃO, RES, OP1, OP2
+			stbAppend(buffer, "%s, ", ARIT_OP_NAMES[bitsOpr]);
+			stbAppend(buffer, "%s, ", REGISTER_NAMES[bitsDst]);
+			stbAppend(buffer, "%s, ", REGISTER_NAMES[bitsOp1]);
+			stbAppend(buffer, "%s ", (op2zero) ? "zero" : REGISTER_NAMES[bitsOp2 & 0b011]);
+		}
+		break;
+
+	case OPCODE_HLT:
+		stbAppend(buffer, "%s", name);
+		break;
+
+	// Instrução desconhecida
+	default:
+		stbAppend(buffer, TERM_BOLD_YELLOW "%s :: %X.%03X", name, opcode, argument);
+		break;
+	}
+
+	return bufferStg;
+}
+
+/// @brief Configura um ponto de parada na memória do emulador.
+/// @param addr Posição na memória onde a execução vai parar.
+/// @param hits Número máximo de vezes que esse breakpoint será acertado antes de ser desativado.
+/// Se o número de hits for -1, o breakpoint é considerado infinito e nunca será desativado.
+/// Se hits for 0, o breakpoint será configurado já desativado.
+void emuSetBreakpoint(uint16_t addr, int hits) {
+	bool wasActive = emuBreakpointActive(addr);
+	bool active = hits != 0;
+	emulator.breakpointHits[addr] = hits;
+
+	// Mantém o bitmap e a contagem de ativos. Se um breakpoint com esse endereço já existe, apenas
+	// o número de hits dele muda
+	if (active != wasActive) {
+		emulator.breakpointBits[addr >> 6] ^= (uint64_t)1 << (addr & 63);
+		emulator.activeBreakpoints += active ? 1 : -1;
+
+		// A instrução precisa ser decodificada novamente para que os núcleos parem (ou não) nela
+		emuInvalidate(addr);
+	}
+}
+
+/// @brief Remove um breakpoint previamente configurado. Se o breakpoint não existe, não faz nada.
+/// @param addr O endereço do breakpoint a remover
+/// @return Um booleano se o breakpoint existia ou não 
+bool emuRemoveBreakpoint(uint16_t addr) {
+	if (!emuHasBreakpoint(addr)) return false;
+
+	emuSetBreakpoint(addr, 0);
+	emuSetBreakpointCondition(addr, NULL);
+	emulator.breakpointHits[addr] = BREAKPOINT_NONE;
+	return true;
+}
+
+/// @brief Troca a condição do breakpoint no endereço dado, liberando a anterior. NULL torna o
+/// breakpoint incondicional.
+void emuSetBreakpointCondition(uint16_t addr, BreakCondition* condition) {
+	BreakCondition* old = emulator.breakpointConditions[addr];
+	if (old) {
+		exprFree(&old->condition);
+		exprFree(&old->trace);
+		free(old->traceText);
+		free(old);
+	}
+
+	emulator.breakpointConditions[addr] = condition;
+}
+
+/// @brief Avalia, ao chegar em um breakpoint ativo, se a execução deve parar. Breakpoints
+/// condicionais só param com a condição verdadeira; tracepoints imprimem a expressão e não param.
+bool emuBreakpointStops(uint16_t addr) {
+	BreakCondition* condition = emulator.breakpointConditions[addr];
+	if (!condition) return true;
+
+	condition->reached++;
+	if (!exprEvaluate(&condition->condition, condition->reached)) return false;
+	if (!condition->traceText) return true;
+
+	int32_t value = exprEvaluate(&condition->trace, condition->reached);
+	uiPrintf(TERM_CYAN "[trace 0x%03X]" TERM_RESET " %s = 0x%04X (%i)\n",
+		addr, condition->traceText, (uint16_t)value, value);
+	return false;
+}
+
+/// @brief Usada pelos núcleos ao encontrar uma instrução com trap. Retorna verdadeiro se o trap é
+/// só de um breakpoint condicional ou tracepoint que não para agora, e a instrução pode ser
+/// executada sem devolver o controle ao chamador.
+bool emuPassBreakpoint(uint16_t addr) {
+	uint16_t instruction = emulator.memory[addr];
+	if (!emulator.breakpointConditions[addr] || !emuBreakpointActive(addr)) return false;
+	if ((instruction & 0xF000) >> 12 == OPCODE_HLT || emuAccessWatched(instruction)) return false;
+
+	if (emuBreakpointStops(addr)) {
+		emulator.breakpointConfirmed = true;
+		return false;
+	}
+	return true;
+}
+
+/// @brief Retorna se há um breakpoint, ativo ou desativado, no endereço dado
+bool emuHasBreakpoint(uint16_t addr) {
+	return emulator.breakpointHits[addr] != BREAKPOINT_NONE;
+}
+
+/// @brief Retorna se há um breakpoint ativo no endereço dado. Sem nenhum breakpoint ativo, não
+/// consulta nem o bitmap.
+static inline bool emuBreakpointActive(uint16_t addr) {
+	return emulator.activeBreakpoints && (emulator.breakpointBits[addr >> 6] >> (addr & 63)) & 1;
+}
+
+/// @brief Configura um watchpoint sobre uma palavra da memória do emulador.
+/// @param addr Endereço observado.
+/// @param kinds Tipos de acesso que disparam o watchpoint (bits WATCH_*).
+/// @param hits Número de vezes que o watchpoint dispara antes de ser desativado, como nos breakpoints.
+void emuSetWatchpoint(uint16_t addr, uint8_t kinds, int hits) {
+	bool wasActive = emulator.watchBits[addr >> 6] >> (addr & 63) & 1;
+	bool active = hits != 0;
+	emulator.watchKinds[addr] = kinds;
+	emulator.watchHits[addr] = hits;
+
+	if (active == wasActive) return;
+	emulator.watchBits[addr >> 6] ^= (uint64_t)1 << (addr & 63);
+	emulator.activeWatchpoints += active ? 1 : -1;
+
+	// Os LDAs e STAs sobre esse endereço precisam ser decodificados novamente para que os núcleos
+	// parem (ou não) neles
+	for (int i = 0; i < emulator.memorySize; i++) {
+		uint8_t opcode = (emulator.memory[i] & 0xF000) >> 12;
+		if ((opcode == OPCODE_LDA || opcode == OPCODE_STA) && (emulator.memory[i] & 0x0FFF) == addr) {
+			emuInvalidate(i);
+		}
+	}
+}
+
+/// @brief Remove um watchpoint previamente configurado. Se o watchpoint não existe, não faz nada.
+/// @return Um booleano se o watchpoint existia ou não
+bool emuRemoveWatchpoint(uint16_t addr) {
+	if (emulator.watchHits[addr] == BREAKPOINT_NONE) return false;
+
+	emuSetWatchpoint(addr, 0, 0);
+	emulator.watchHits[addr] = BREAKPOINT_NONE;
+	return true;
+}
+
+/// @brief Retorna se a instrução é um LDA ou STA sobre um endereço com watchpoint armado. Sem
+/// nenhum watchpoint armado, não consulta nem o bitmap.
+static inline bool emuAccessWatched(uint16_t instruction) {
+	if (!emulator.activeWatchpoints) return false;
+
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = (instruction & 0x0FFF);
+	if (opcode != OPCODE_LDA && opcode != OPCODE_STA) return false;
+	return (emulator.watchBits[argument >> 6] >> (argument & 63)) & 1;
+}
+
+/// @brief Retorna se a instrução no endereço dado precisa passar pelo caminho padrão do depurador:
+/// tem um breakpoint ativo ou acessa um endereço observado
+static inline bool emuTrapActive(uint16_t address) {
+	return emuBreakpointActive(address) || emuAccessWatched(emulator.memory[address]);
+}
+
+// Verifica se um enderço se memória está dentro dos limites possíveis do tamanho da memória
+// do emulador. Se o endereço estiver fora do limite, causa uma falha e retorna true.
+bool emuGuardAddress(uint16_t addr) {
+	if (addr >= emulator.memorySize) {
+		uint32_t PC = emulator.registers->PC;
+
+		emuFault("Memory access out of bounds 0x%04X at 0x%03X", addr, PC);
+		return true;
+	}
+
+	return false;
+}
+
+// Lança uma falha de CPU por tentar executar uma instrução mal formulada ou que não existe
+void emuBadInstruction() {
+	uint32_t RI = emulator.registers->RI;
+	uint32_t PC = emulator.registers->PC;
+	emuFault("Bad instruction 0x%04X at 0x%03X", RI, PC);
+}
+
+// Lança uma falha de CPU com a mensagem formata desejada
+void emuFault(const char* fmt, ...) {
+	// Reexecutando pelo diário, a falha já foi relatada da primeira vez
+	if (journal.replaying) return;
+
+	va_list args;
+	va_start(args, fmt);
+
+	// Imprime a mensagem de CPU FAULT no terminal
+	StringBuffer sb;
+	stbInit(&sb);
+	stbAppend(&sb, TERM_BOLD_RED TERM_BOLD_RED "[ERR!] CPU FAULT: " TERM_RESET);
+	stbAppendv(&sb, fmt, args);
+	stbAppend(&sb, "\n");
+	uiPrintf("%s\n", sb.array);
+	stbFree(&sb);
+
+	// Coloca o emulador em modo step-through e interrompe qualquer sequência de steps se havia
+	// alguma antes
+	if (emulator.breakOnFaults) {
+		emulator.breaking = true;
+		emulator.stepsLeft = 0;
+	}
+
+	va_end(args);
+}
+
+// Imprime no console um warning
+void emuWarn(const char* fmt, ...) {
+	if (journal.replaying) return;
+
+	va_list args;
+	va_start(args, fmt);
+
+	StringBuffer sb;
+	stbInit(&sb);
+
+	stbAppend(&sb, TERM_BOLD_YELLOW "[WRN!] " TERM_RESET);
+	stbAppendv(&sb, fmt, args);
+	
+	uiPrintf("%s\n\n", sb.array);
+	stbFree(&sb);
+
+	va_end(args);
+}
+
+// Imprime no terminal o conteúdo de todos os registradores da CPU emulada
+void emuDumpRegisters() {
+	Registers* regs = emulator.registers;
+	emuSyncFlags();
+
+	printf("---- Program registers ----\n");
+	uint16_t psw = regs->PSW;
+	printf("PC:  0x%04hx\n", regs->PC);
+	printf("RI:  0x%04hx\n", regs->RI);
+	printf("PSW: 0x%04hx\n", regs->PSW);
+	printf("  OV=%i UN=%i ", (int)getBit(psw, 15), (int)getBit(psw, 14));
+	printf("LE=%i EQ=%i GR=%i\n", (int)getBit(psw, 13), (int)getBit(psw, 12), (int)getBit(psw, 11));
+	printf("R:   0x%04hx\n", regs->R);
+	printf("\n");
+	printf("A:   0x%04hx\n", regs->A);
+	printf("B:   0x%04hx\n", regs->B);
+	printf("C:   0x%04hx\n", regs->C);
+	printf("D:   0x%04hx\n", regs->D);	
+}
+
+// Handler de SIGINT (interrupção pelo CTRL-C). Usa apenas funções seguras dentro de um handler de
+// sinal: a mensagem e a parada do emulador ficam para cliPollInterrupt
+void signIntHandler(int sign) {
+	static volatile sig_atomic_t interruptedBefore = 0;
+
+	// Ignore the signal while handling it
+	signal(sign, SIG_IGN);
+
+	// If ctrl-c was pressed before and within a certain time threshold, exit the application
+	time_t now = time(NULL);
+	if (interruptedBefore && difftime(now, lastInterruptBreak) < 1.5) {
+		_Exit(0);
+	}
+
+	// Save last time ctrl-c was pressed
+	interruptedBefore = 1;
+	lastInterruptBreak = now;
+
+	// Ask the emulator to break execution
+	interruptPending = 1;
+
+	// Reset signal handler
+	signal(SIGINT, signIntHandler);
+}
+
+/// @brief Consome o pedido de interrupção do CTRL-C, se houver um, colocando o emulador em modo
+/// step-through.
+/// @return true se havia um pedido de interrupção.
+bool cliPollInterrupt() {
+	if (!interruptPending) return false;
+	interruptPending = 0;
+
+	printf(TERM_RESET "\n-- Ctrl-C pressed. Breaking execution.\n");
+
+	// Put the emulator in breaking mode
+	emulator.stepsLeft = 0;
+	emulator.breaking = true;
+	return true;
+}
+
+// -- Thread de interface
+//
+// Fora do modo step-through, o núcleo não imprime nada diretamente: o trace das instruções e as
+// mensagens de falhas, avisos, watchpoints e tracepoints viram eventos em uma fila circular lida por
+// uma thread de interface, que os formata e imprime. A fila tem um único produtor (o núcleo) e um
+// único consumidor (a thread), então basta que cada lado publique o seu índice com as barreiras de
+// acquire/release, sem locks. Com a fila vazia, a thread dorme em uma variável de condição e o núcleo
+// só a acorda se ela avisou que está dormindo. Com a fila cheia, o núcleo espera (--ui-thread=block,
+// o padrão) ou descarta o evento e conta o descarte (--ui-thread=drop). Antes de imprimir
+// diretamente, como no prompt, o núcleo espera com uiFlush a fila esvaziar.
+
+// Número de eventos na fila. Precisa ser uma potência de 2.
+#define UI_RING_SIZE 8192
+
+// Tipos de evento: linha de trace de uma instrução e texto já formatado
+#define UI_TRACE 0
+#define UI_TEXT  1
+
+/// @brief Evento da fila da thread de interface. Eventos de trace guardam a instrução e o estado do
+/// breakpoint no momento da execução. O texto é alocado pelo núcleo e liberado pela thread.
+typedef struct {
+	char* text;
+	int breakpointHits;
+	uint16_t address;
+	uint16_t instruction;
+	uint8_t type;
+} UiEvent;
+
+static struct {
+	UiEvent events[UI_RING_SIZE];
+
+	// head só é escrito pelo núcleo e tail só pela thread
+	uint32_t head;
+	uint32_t tail;
+
+	// Eventos descartados desde o último uiFlush, só acessado pelo núcleo
+	uint64_t dropped;
+
+	// stopping só é escrito pelo núcleo e sleeping só pela thread
+	bool running;
+	bool stopping;
+	bool sleeping;
+#if !defined(_WIN32)
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+#endif
+} ui;
+
+/// @brief Imprime um evento e libera o seu texto
+static void uiWriteEvent(UiEvent* event) {
+	if (event->type == UI_TRACE) {
+		emuWriteDisassemblyLine(event->address, event->instruction, event->breakpointHits);
+	} else {
+		fputs(event->text, stdout);
+		free(event->text);
+	}
+}
+
+/// @brief Espera um pouco quando o núcleo precisa que a thread esvazie a fila
+static void uiPause() {
+#if !defined(_WIN32)
+	struct timespec pause = { 0, 50000 };
+	nanosleep(&pause, NULL);
+#endif
+}
+
+/// @brief Acorda a thread de interface se ela estiver dormindo. Chamada pelo núcleo depois de
+/// publicar um evento ou o pedido de parada, ambos com ordem sequencial, de forma que ou a thread vê
+/// a publicação antes de dormir ou o núcleo a vê dormindo.
+static void uiWake() {
+#if !defined(_WIN32)
+	if (!__atomic_load_n(&ui.sleeping, __ATOMIC_SEQ_CST)) return;
+
+	pthread_mutex_lock(&ui.lock);
+	pthread_cond_signal(&ui.wakeup);
+	pthread_mutex_unlock(&ui.lock);
+#endif
+}
+
+#if !defined(_WIN32)
+/// @brief Dorme até o núcleo colocar um evento depois de tail na fila ou pedir a parada da thread
+static void uiSleep(uint32_t tail) {
+	pthread_mutex_lock(&ui.lock);
+	__atomic_store_n(&ui.sleeping, true, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&ui.head, __ATOMIC_SEQ_CST) == tail
+		&& !__atomic_load_n(&ui.stopping, __ATOMIC_SEQ_CST)) {
+		pthread_cond_wait(&ui.wakeup, &ui.lock);
+	}
+
+	__atomic_store_n(&ui.sleeping, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&ui.lock);
+}
+
+// Laço da thread de interface: imprime os eventos até a fila esvaziar com uiStop pedido
+static void* uiThreadMain(void* arg) {
+	while (true) {
+		uint32_t tail = ui.tail;
+		uint32_t head = __atomic_load_n(&ui.head, __ATOMIC_ACQUIRE);
+
+		if (tail == head) {
+			if (__atomic_load_n(&ui.stopping, __ATOMIC_ACQUIRE)) break;
+			fflush(stdout);
+			uiSleep(tail);
+			continue;
+		}
+
+		while (tail != head) {
+			uiWriteEvent(&ui.events[tail & (UI_RING_SIZE - 1)]);
+			tail++;
+			__atomic_store_n(&ui.tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+
+	fflush(stdout);
+	return NULL;
+}
+#endif
+
+/// @brief Inicia a thread de interface, se a opção --ui-thread permitir. Sem threads (Windows), as
+/// mensagens continuam sendo impressas diretamente.
+void uiStart() {
+#if !defined(_WIN32)
+	if (options.ui == UI_SYNC || ui.running) return;
+
+	ui.head = ui.tail = 0;
+	ui.dropped = 0;
+	ui.stopping = ui.sleeping = false;
+	pthread_mutex_init(&ui.lock, NULL);
+	pthread_cond_init(&ui.wakeup, NULL);
+	ui.running = pthread_create(&ui.thread, NULL, uiThreadMain, NULL) == 0;
+#endif
+}
+
+/// @brief Imprime os eventos pendentes e encerra a thread de interface
+void uiStop() {
+	uiFlush();
+#if !defined(_WIN32)
+	if (!ui.running) return;
+
+	__atomic_store_n(&ui.stopping, true, __ATOMIC_SEQ_CST);
+	uiWake();
+	pthread_join(ui.thread, NULL);
+	pthread_mutex_destroy(&ui.lock);
+	pthread_cond_destroy(&ui.wakeup);
+	ui.running = false;
+#endif
+}
+
+/// @brief Espera a thread de interface imprimir todos os eventos da fila, e informa quantos foram
+/// descartados
+void uiFlush() {
+	if (!ui.running) return;
+
+	while (__atomic_load_n(&ui.tail, __ATOMIC_ACQUIRE) != ui.head) uiPause();
+
+	if (ui.dropped) {
+		printf(TERM_YELLOW "[%llu messages dropped]\n" TERM_RESET, (unsigned long long)ui.dropped);
+		ui.dropped = 0;
+	}
+}
+
+/// @brief Coloca um evento na fila, aplicando a política de fila cheia
+static void uiPush(const UiEvent* event) {
+	uint32_t head = ui.head;
+	while (head - __atomic_load_n(&ui.tail, __ATOMIC_ACQUIRE) == UI_RING_SIZE) {
+		if (options.ui == UI_DROP) {
+			ui.dropped++;
+			if (event->type == UI_TEXT) free(event->text);
+			return;
+		}
+		uiPause();
+	}
+
+	ui.events[head & (UI_RING_SIZE - 1)] = *event;
+	__atomic_store_n(&ui.head, head + 1, __ATOMIC_SEQ_CST);
+	uiWake();
+}
+
+/// @brief Imprime a linha de trace da instrução no endereço, pela thread de interface se ela estiver
+/// rodando
+void uiTrace(uint16_t address) {
+	if (!ui.running || address >= emulator.memorySize) {
+		emuPrintDisassemblyLine(address);
+		return;
+	}
+
+	UiEvent event = {
+		.type = UI_TRACE, .address = address, .instruction = emulator.memory[address],
+		.breakpointHits = emulator.breakpointHits[address]
+	};
+	uiPush(&event);
+}
+
+/// @brief printf das mensagens do núcleo, pela thread de interface se ela estiver rodando
+void uiPrintf(const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+
+	if (!ui.running) {
+		vprintf(fmt, args);
+		va_end(args);
+		return;
+	}
+
+	StringBuffer sb;
+	stbInit(&sb);
+	stbAppendv(&sb, fmt, args);
+	va_end(args);
+
+	// O texto passa a pertencer ao evento
+	UiEvent event = { .type = UI_TEXT, .text = sb.array };
+	uiPush(&event);
+}
+
+// -- Exportação do estado pela memória compartilhada
+//
+// Com a opção --shm=<nome>, os registradores, a memória e o contador de instruções são publicados em
+// um segmento de memória compartilhada POSIX (shm_open), onde ferramentas externas podem observar o
+// programa em execução sem pará-lo. Os núcleos publicam o estado a cada --shm-interval instruções,
+// nos pontos em que já param para o depurador (entre os blocos de instruções do núcleo switch e nas
+// fronteiras de bloco do threaded), e sempre que o emulador para no prompt.
+
+/// @brief Cria o segmento de memória compartilhada com o nome dado e publica o estado inicial
+/// @return false se o segmento não pôde ser criado.
+bool shmOpen(const char* name) {
+#if !defined(_WIN32)
+	shm.size = sizeof(ShmState) + emulator.memorySize * sizeof(uint16_t);
+
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, shm.size) != 0) {
+		fprintf(stderr, "Could not create the shared memory segment '%s'.\n", name);
+		if (fd >= 0) close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, shm.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Could not map the shared memory segment '%s'.\n", name);
+		return false;
+	}
+
+	shm.state = (ShmState*)data;
+	memset(shm.state, 0, sizeof(ShmState));
+	memcpy(shm.state->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+	shm.state->version = SHM_VERSION;
+	shm.state->memorySize = emulator.memorySize;
+
+	shmPublish();
+	return true;
+#else
+	fprintf(stderr, "Shared memory export is not available on this platform.\n");
+	return false;
+#endif
+}
+
+/// @brief Publica o estado final e remove o nome do segmento. Leitores que já o mapearam continuam
+/// vendo o último estado.
+void shmClose() {
+#if !defined(_WIN32)
+	if (!shm.state) return;
+
+	shmPublish();
+	munmap(shm.state, shm.size);
+	shm_unlink(options.shmName);
+	shm.state = NULL;
+#endif
+}
+
+/// @brief Copia o estado atual para o segmento, protegido pelo contador de sequência
+void shmPublish() {
+	ShmState* state = shm.state;
+	emuSyncFlags();
+
+	uint32_t sequence = state->sequence;
+	__atomic_store_n(&state->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	state->instructionCount = emulator.instructionCount;
+	state->registers = *emulator.registers;
+	memcpy(state->memory, emulator.memory, emulator.memorySize * sizeof(uint16_t));
+
+	__atomic_store_n(&state->sequence, sequence + 2, __ATOMIC_RELEASE);
+	shm.next = emulator.instructionCount + options.shmInterval;
+}
+
+// -- Gravação do trace binário
+//
+// Com a opção --record=<arquivo>, cada instrução executada é gravada como um TraceRecord de
+// tamanho fixo (ver emulTrace.h), sem formatação alguma durante a execução. Os registros são
+// acumulados em um buffer de TRACE_BUFFER_RECORDS e escritos no arquivo em blocos. A ferramenta
+// emul-trace decodifica, filtra e desmonta o trace depois.
+
+/// @brief Cria o arquivo do trace e escreve o seu cabeçalho
+/// @return false se o arquivo não pôde ser criado.
+bool recorderOpen(const char* path) {
+	recorder.file = fopen(path, "wb");
+	if (!recorder.file) {
+		fprintf(stderr, "Could not create the trace file '%s'.\n", path);
+		return false;
+	}
+
+	TraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.recordSize = sizeof(TraceRecord);
+	header.memorySize = emulator.memorySize;
+	header.firstInstruction = emulator.instructionCount;
+	fwrite(&header, sizeof(header), 1, recorder.file);
+
+	recorder.buffer = (TraceRecord*)malloc(TRACE_BUFFER_RECORDS * sizeof(TraceRecord));
+	recorder.count = 0;
+	recorder.pc = 0xFFFF;
+	recorder.psw = 0;
+	return true;
+}
+
+/// @brief Escreve no arquivo os registros acumulados no buffer
+static void recorderFlush() {
+	fwrite(recorder.buffer, sizeof(TraceRecord), recorder.count, recorder.file);
+	recorder.count = 0;
+}
+
+/// @brief Escreve os últimos registros e fecha o arquivo do trace
+void recorderClose() {
+	if (!recorder.file) return;
+
+	recorderFlush();
+	if (fclose(recorder.file) != 0) {
+		fprintf(stderr, "Could not write the trace file '%s'.\n", options.record);
+	}
+	free(recorder.buffer);
+	recorder.file = NULL;
+}
+
+/// @brief Grava a instrução que acabou de ser executada no endereço pc
+static inline void recorderRecord(uint16_t pc, uint16_t instruction, EmuResult result) {
+	Registers* regs = emulator.registers;
+	uint16_t flags = (result == EMU_FAULT) ? TRACE_FAULT : 0;
+	uint16_t value = 0;
+
+	switch ((instruction & 0xF000) >> 12) {
+	case OPCODE_LDA:
+	case OPCODE_STA:
+		value = regs->A;
+		break;
+	case OPCODE_JMP:
+	case OPCODE_JNZ:
+	case OPCODE_RET:
+		value = regs->R;
+		break;
+	case OPCODE_ARIT: {
+		// A PSW gravada precisa das flags que a ARIT deixou pendentes
+		emuSyncFlags();
+		uint16_t* dst = emuGetRegister((instruction & 0x01C0) >> 6);
+		if (dst) {
+			value = *dst;
+		} else {
+			flags |= TRACE_FAULT;
+		}
+		break;
+	}
+	}
+
+	TraceRecord* record = &recorder.buffer[recorder.count];
+	record->pc = ((pc - recorder.pc - 1) & TRACE_PC_MASK) | flags;
+	record->ri = instruction;
+	record->value = value;
+	record->psw = regs->PSW ^ recorder.psw;
+	recorder.pc = pc;
+	recorder.psw = regs->PSW;
+
+	if (++recorder.count == TRACE_BUFFER_RECORDS) recorderFlush();
+}
+
+// -- Imagens do estado do emulador
+//
+// O comando save grava o estado completo do emulador em um arquivo binário, que o comando load e a
+// opção --resume restauram. A imagem começa com um StateHeader e segue com as seções abaixo, todas
+// alinhadas em 8 bytes para que o arquivo possa ser mapeado diretamente na memória:
+//   memória               memorySize palavras de 16 bits
+//   hits dos breakpoints  memorySize ints (BREAKPOINT_NONE onde não há breakpoint)
+//   tipos dos watchpoints ADDRESS_SPACE bytes (bits WATCH_*)
+//   hits dos watchpoints  ADDRESS_SPACE ints
+// Os valores ficam na ordem de bytes da máquina. As condições dos breakpoints e os tracepoints não
+// fazem parte da imagem.
+
+#define STATE_MAGIC "OACSTATE"
+#define STATE_VERSION 2
+
+/// @brief Cabeçalho de uma imagem de estado. checksum cobre todas as seções depois do cabeçalho, e
+/// programChecksum a memória inicial do programa, para que a imagem só seja restaurada sobre o mesmo
+/// arquivo de memória.
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t memorySize;
+	uint32_t checksum;
+	uint32_t programChecksum;
+	uint64_t instructionCount;
+	uint64_t fusionCounts[FUSION_COUNT];
+	Registers registers;
+} StateHeader;
+
+// Arredonda o tamanho de uma seção para múltiplos de 8 bytes
+#define STATE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+/// @brief Tamanho das seções de uma imagem de estado com o tamanho de memória dado
+static void stateLayout(uint32_t memorySize, size_t sections[4]) {
+	sections[0] = STATE_ALIGN(memorySize * sizeof(uint16_t));
+	sections[1] = STATE_ALIGN(memorySize * sizeof(int));
+	sections[2] = STATE_ALIGN(ADDRESS_SPACE * sizeof(uint8_t));
+	sections[3] = STATE_ALIGN(ADDRESS_SPACE * sizeof(int));
+}
+
+/// @brief Checksum FNV-1a de 32 bits de um bloco de bytes
+static uint32_t stateChecksum(const uint8_t* data, size_t size) {
+	uint32_t hash = 0x811C9DC5;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ data[i]) * 0x01000193;
+	}
+	return hash;
+}
+
+/// @brief Grava o estado atual do emulador em uma imagem de estado.
+/// @return false se o arquivo não pôde ser escrito.
+bool emuSaveState(const char* path) {
+	size_t sections[4];
+	stateLayout(emulator.memorySize, sections);
+	size_t payloadSize = sections[0] + sections[1] + sections[2] + sections[3];
+
+	// Monta as seções em um único bloco zerado, para que o preenchimento de alinhamento também seja
+	// determinístico e entre no checksum
+	uint8_t* payload = (uint8_t*)calloc(payloadSize, 1);
+	uint8_t* section = payload;
+	memcpy(section, emulator.memory, emulator.memorySize * sizeof(uint16_t));
+	section += sections[0];
+	memcpy(section, emulator.breakpointHits, emulator.memorySize * sizeof(int));
+	section += sections[1];
+	memcpy(section, emulator.watchKinds, ADDRESS_SPACE * sizeof(uint8_t));
+	section += sections[2];
+	memcpy(section, emulator.watchHits, ADDRESS_SPACE * sizeof(int));
+
+	// A imagem guarda a PSW já com as flags pendentes aplicadas
+	emuSyncFlags();
+
+	StateHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+	header.version = STATE_VERSION;
+	header.memorySize = emulator.memorySize;
+	header.checksum = stateChecksum(payload, payloadSize);
+	header.programChecksum = stateChecksum((const uint8_t*)emulator.snapshot,
+		emulator.memorySize * sizeof(uint16_t));
+	header.instructionCount = emulator.instructionCount;
+	memcpy(header.fusionCounts, emulator.fusionCounts, sizeof(header.fusionCounts));
+	header.registers = *emulator.registers;
+
+	FILE* file = fopen(path, "wb");
+	bool ok = file
+		&& fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(payload, payloadSize, 1, file) == 1;
+	if (file && fclose(file) != 0) ok = false;
+	free(payload);
+
+	if (!ok) printf(TERM_RED "Could not write the state file '%s'.\n" TERM_RESET, path);
+	return ok;
+}
+
+/// @brief Mapeia um arquivo inteiro para leitura. Sem mmap (Windows), lê o arquivo para um bloco
+/// alocado.
+/// @return O conteúdo do arquivo, ou NULL se ele não pôde ser lido.
+static const uint8_t* stateMap(const char* path, size_t* size) {
+#if !defined(_WIN32)
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+
+	*size = info.st_size;
+	return (const uint8_t*)data;
+#else
+	FILE* file = fopen(path, "rb");
+	if (!file) return NULL;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	uint8_t* data = (length > 0) ? (uint8_t*)malloc(length) : NULL;
+	if (data && fread(data, length, 1, file) != 1) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+
+	*size = length;
+	return data;
+#endif
+}
+
+/// @brief Libera um arquivo obtido por stateMap
+static void stateUnmap(const uint8_t* data, size_t size) {
+#if !defined(_WIN32)
+	munmap((void*)data, size);
+#else
+	free((void*)data);
+#endif
+}
+
+/// @brief Restaura o estado do emulador a partir de uma imagem de estado. A imagem precisa ter sido
+/// salva com o mesmo arquivo de memória. Em caso de erro, o estado atual não é alterado.
+/// @return false se a imagem não pôde ser lida ou é inválida.
+bool emuLoadState(const char* path) {
+	size_t size;
+	const uint8_t* data = stateMap(path, &size);
+	if (!data) {
+		printf(TERM_RED "Could not read the state file '%s'.\n" TERM_RESET, path);
+		return false;
+	}
+
+	const StateHeader* header = (const StateHeader*)data;
+	const char* error = NULL;
+	size_t sections[4];
+	size_t payloadSize = 0;
+
+	if (size < sizeof(StateHeader) || memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) != 0) {
+		error = "not an emulator state file";
+	} else if (header->version != STATE_VERSION) {
+		error = "unsupported state file version";
+	} else if (header->memorySize != (uint32_t)emulator.memorySize) {
+		error = "the state was saved with a different memory size";
+	} else if (header->programChecksum != stateChecksum((const uint8_t*)emulator.snapshot,
+		emulator.memorySize * sizeof(uint16_t))) {
+		error = "the state was saved with a different memory file";
+	} else {
+		stateLayout(header->memorySize, sections);
+		payloadSize = sections[0] + sections[1] + sections[2] + sections[3];
+		if (size != sizeof(StateHeader) + payloadSize) {
+			error = "truncated state file";
+		} else if (stateChecksum(data + sizeof(StateHeader), payloadSize) != header->checksum) {
+			error = "checksum mismatch";
+		}
+	}
+
+	if (error) {
+		printf(TERM_RED "Could not load '%s': %s.\n" TERM_RESET, path, error);
+		stateUnmap(data, size);
+		return false;
+	}
+
+	const uint8_t* section = data + sizeof(StateHeader);
+	const uint16_t* memory = (const uint16_t*)section;
+	section += sections[0];
+	const int* breakpointHits = (const int*)section;
+	section += sections[1];
+	const uint8_t* watchKinds = section;
+	section += sections[2];
+	const int* watchHits = (const int*)section;
+
+	// Registradores, sem flags pendentes, e contadores
+	*emulator.registers = header->registers;
+	LazyFlags* lazy = &emulator.lazyFlags;
+	lazy->cmpPending = lazy->ovPending = lazy->unPending = false;
+	emulator.instructionCount = header->instructionCount;
+	memcpy(emulator.fusionCounts, header->fusionCounts, sizeof(emulator.fusionCounts));
+
+	// Memória. Toda a decodificação anterior deixa de valer.
+	memcpy(emulator.memory, memory, emulator.memorySize * sizeof(uint16_t));
+	emuInvalidateAll();
+
+	// Breakpoints e watchpoints passam pelas funções que mantêm os bitmaps. As condições dos
+	// breakpoints que continuam existindo são mantidas.
+	for (int i = 0; i < emulator.memorySize; i++) {
+		if (breakpointHits[i] == BREAKPOINT_NONE) {
+			emuRemoveBreakpoint(i);
+		} else {
+			emuSetBreakpoint(i, breakpointHits[i]);
+		}
+	}
+
+	for (int i = 0; i < ADDRESS_SPACE; i++) {
+		if (watchHits[i] == BREAKPOINT_NONE) {
+			emuRemoveWatchpoint(i);
+		} else {
+			emuSetWatchpoint(i, watchKinds[i], watchHits[i]);
 		}
-	} else {
-		// Caso contrário, imprime em branco
-		stbAppend(&msgBuffer, "§F[%3Xh]§R ", address);
 	}
 
-	stbAppend(&msgBuffer, "%X.%03X: ", opcode, argument);
-	
-	// Transforma a instrução em string e adiciona na string da mensagem
-	StringBuffer disassembly = emuDisassembly(instruction);
-	stbAppendBuffer(&msgBuffer, &disassembly);
-	stbFree(&disassembly);
+	stateUnmap(data, size);
 
-	stbColorize(&msgBuffer, ENABLE_COLORS);
-	printf("%s\n" TERM_RESET, msgBuffer.array);
-	stbFree(&msgBuffer);
+	// O diário e o detector de laços descrevem a execução anterior
+	if (journal.entries) journalClear();
+	if (options.detectLoops) emuDetectorInitialize();
+	emulator.rewound = true;
+	return true;
 }
 
-// Retorna uma string que representa o disassembly da instrução passada
-StringBuffer emuDisassembly(uint16_t instruction) {
-	// Inicializa um buffer para as strings impressas nessa função
-	StringBuffer bufferStg;
-	StringBuffer* buffer = &bufferStg;
-	stbInit(buffer);
-
-	// Extrai o opcode e o argumento X da instrução
-	uint8_t opcode = (instruction & 0xF000) >> 12;
-	uint16_t argument = (instruction & 0x0FFF);
-		
-	// Obtém o nome da instrução pelo opcode
-	const char* name = INSTRUCTION_NAMES[opcode];
+// -- Imagens binárias de memória
+//
+// Além do formato texto do Logisim, programas e memórias finais podem ser guardados em um formato
+// binário compacto: um cabeçalho de IMAGE_HEADER_SIZE bytes seguido das palavras de memória. Todos
+// os campos são little-endian:
+//   0  magic     "OACIMAGE"
+//   8  version   32 bits
+//   12 words     32 bits, número de palavras de memória
+//   16 checksum  32 bits, FNV-1a das palavras como gravadas no arquivo
+//   20 entryPC   16 bits, endereço da primeira instrução
+//   22 reserved  16 bits, zero
+// A entrada é reconhecida pelo magic, qualquer que seja a extensão do arquivo. A opção --dump=binary
+// escreve a memória final nesse formato, e --convert converte uma imagem entre os dois formatos. As
+// opções --dump=delta e --dump=delta-binary escrevem apenas as palavras alteradas pelo programa.
+
+#define IMAGE_MAGIC "OACIMAGE"
+#define IMAGE_VERSION 1
+#define IMAGE_HEADER_SIZE 24
+
+#define DELTA_MAGIC "OACDELTA"
+#define DELTA_VERSION 1
+
+static uint32_t imageRead32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-	// As instruções por padrão sairão em azul claro
-	stbAppend(buffer, TERM_CYAN);
+static void imageWrite32(uint8_t* p, uint32_t value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
 
-	switch(opcode) {
-	case OPCODE_NOP:
-		stbAppend(buffer, TERM_BOLD_BLACK "%s ", name);
-		break;
+// As palavras do arquivo só podem ser usadas diretamente como memória em máquinas little-endian
+static bool imageHostIsLittleEndian() {
+	const uint16_t probe = 1;
+	return *(const uint8_t*)&probe == 1;
+}
 
-	case OPCODE_LDA:
-		stbAppend(buffer, "%s [%Xh]", name, argument);
-		break;
+/// @brief Carrega uma imagem binária de memória. Em sistemas POSIX little-endian, o arquivo é
+/// mapeado duas vezes com MAP_PRIVATE: uma visão de escrita usada como memória viva e uma somente
+/// leitura usada como snapshot do reset, que compartilham as páginas do arquivo até a primeira
+/// escrita em cada uma. Nos demais, as palavras são copiadas para um bloco alocado.
+/// @return 1 se a imagem foi carregada em *memory, 0 se o arquivo não é uma imagem binária e -1 se
+/// ela é inválida.
+int imageLoad(const char* path, uint16_t** memory, int* memorySize) {
+	size_t size;
+	const uint8_t* data = stateMap(path, &size);
+	if (!data) return 0;
 
-	case OPCODE_STA:
-		stbAppend(buffer, "%s [%Xh]", name, argument);
-		break;
+	if (size < IMAGE_HEADER_SIZE || memcmp(data, IMAGE_MAGIC, 8) != 0) {
+		stateUnmap(data, size);
+		return 0;
+	}
 
-	case OPCODE_JMP:
-		stbAppend(buffer, "%s %Xh", name, argument);
-		break;
+	uint32_t words = imageRead32(data + 12);
+	const uint8_t* payload = data + IMAGE_HEADER_SIZE;
+	const char* error = NULL;
+
+	if (imageRead32(data + 8) != IMAGE_VERSION) {
+		error = "unsupported memory image version";
+	} else if (words == 0 || words > MAXMEMSIZE) {
+		error = "invalid memory size";
+	} else if (size != IMAGE_HEADER_SIZE + words * sizeof(uint16_t)) {
+		error = "truncated memory image";
+	} else if (stateChecksum(payload, words * sizeof(uint16_t)) != imageRead32(data + 16)) {
+		error = "checksum mismatch";
+	}
 
-	case OPCODE_JNZ:
-		stbAppend(buffer, "%s %Xh", name, argument);
-		break;
+	if (error) {
+		fprintf(stderr, "Could not load '%s': %s.\n", path, error);
+		stateUnmap(data, size);
+		return -1;
+	}
 
-	case OPCODE_RET:
-		stbAppend(buffer, "%s", name);
-		break;
+	image.binary = true;
+	image.entryPC = (data[20] | (data[21] << 8)) % words;
+	image.words = words;
+	image.size = size;
+
+#if !defined(_WIN32)
+	if (imageHostIsLittleEndian()) {
+		// A visão de escrita sai de um novo mapeamento do mesmo arquivo; a de leitura já feita
+		// fica como snapshot
+		int fd = open(path, O_RDONLY);
+		void* live = (fd >= 0) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		if (fd >= 0) close(fd);
+
+		if (live != MAP_FAILED) {
+			image.memory = (uint16_t*)((uint8_t*)live + IMAGE_HEADER_SIZE);
+			image.snapshot = (uint16_t*)payload;
+			*memory = image.memory;
+			*memorySize = words;
+			return 1;
+		}
+	}
+#endif
 
-	case OPCODE_ARIT:
-		stbAppend(buffer, "%s ", name);
+	// Sem mmap, ou com outra ordem de bytes, as palavras são copiadas uma a uma
+	image.memory = (uint16_t*)malloc(words * sizeof(uint16_t));
+	for (uint32_t i = 0; i < words; i++) {
+		image.memory[i] = payload[2 * i] | (payload[2 * i + 1] << 8);
+	}
+	stateUnmap(data, size);
 
-		// Extração dos bits respectivamente:
-		// 3 bits que determinam a operação aritmética a realizar
-		// 3 bits que definem o registrador destino da operação
-		// 3 bits que definem o registrador do primeiro operando
-		// 3 bits que definem o registrador do segundo operando
-		uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
-		uint8_t bitsDst = (argument & 0b000111000000) >> 6;
-		uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;	
-		uint8_t bitsOp2 =  argument & 0b000000000111;
+	*memory = image.memory;
+	*memorySize = words;
+	return 1;
+}
 
-		// Se o bit mais significante do operando 2 for 0, o operando em si é o 0 imediato
-		bool op2zero = (bitsOp2 & 0b100) == 0;
+/// @brief Escreve a memória dada como imagem binária, em um único fwrite. O endereço de entrada é o
+/// da imagem de entrada, ou 0 se ela estava no formato texto.
+/// @return 0, ou -1 se o arquivo não pôde ser escrito.
+int imageWrite(FILE* out, const uint16_t* memory, int memorySize) {
+	size_t size = IMAGE_HEADER_SIZE + memorySize * sizeof(uint16_t);
+	uint8_t* data = (uint8_t*)calloc(size, 1);
+	uint8_t* payload = data + IMAGE_HEADER_SIZE;
+
+	for (int i = 0; i < memorySize; i++) {
+		payload[2 * i] = memory[i];
+		payload[2 * i + 1] = memory[i] >> 8;
+	}
 
-		if (extendedNotation) {
-			// Imprime RES = OP1 * OP2
-			stbAppend(buffer, ARIT_EXT_FMT[bitsOpr],
-				REGISTER_NAMES[bitsDst],
-				REGISTER_NAMES[bitsOp1],
-				(op2zero) ? "0" : REGISTER_NAMES[bitsOp2 & 0b011]
-			);
-		} else {
-			// Imprime em sequência OPERAÇÃO, RES, OP1, OP2
-			stbAppend(buffer, "%s, ", ARIT_OP_NAMES[bitsOpr]);
-			stbAppend(buffer, "%s, ", REGISTER_NAMES[bitsDst]);
-			stbAppend(buffer, "%s, ", REGISTER_NAMES[bitsOp1]);
-			stbAppend(buffer, "%s ", (op2zero) ? "zero" : REGISTER_NAMES[bitsOp2 & 0b011]);
-		}
-		break;
+	memcpy(data, IMAGE_MAGIC, 8);
+	imageWrite32(data + 8, IMAGE_VERSION);
+	imageWrite32(data + 12, memorySize);
+	imageWrite32(data + 16, stateChecksum(payload, memorySize * sizeof(uint16_t)));
+	data[20] = image.entryPC;
+	data[21] = image.entryPC >> 8;
 
-	case OPCODE_HLT:
-		stbAppend(buffer, "%s", name);
-		break;
+	bool ok = out && fwrite(data, size, 1, out) == 1;
+	if (out && fclose(out) != 0) ok = false;
+	free(data);
 
-	// Instrução desconhecida
-	default:
-		stbAppend(buffer, TERM_BOLD_YELLOW "%s :: %X.%03X", name, opcode, argument);
-		break;
+	if (!ok) {
+		fprintf(stderr, "Could not write the memory image.\n");
+		return -1;
 	}
-
-	return bufferStg;
+	return 0;
 }
 
-/// @brief Configura um ponto de parada na memória do emulador.
-/// @param addr Posição na memória onde a execução vai parar.
-/// @param hits Número máximo de vezes que esse breakpoint será acertado antes de ser desativado.
-/// Se o número de hits for -1, o breakpoint é considerado infinito e nunca será desativado.
-/// Se hits for 0, o breakpoint será configurado já desativado.
-void emuSetBreakpoint(uint16_t addr, int hits) {
-	// Se um breakpoint com esse endereço já existe, só mude o número de hits dele
-	for (int i = 0; i < emulator.breakpoints.size; i++) {
-		Breakpoint* bp = (Breakpoint*) emulator.breakpoints.array[i];
-		if (bp->address == addr) {
-			bp->hits = hits;
-			return;
+/// @brief Desfaz os mapeamentos de uma imagem binária antes que o driver abra o arquivo de saída,
+/// que pode ser o próprio arquivo da imagem. A memória viva é copiada para o bloco dado, que passa a
+/// ser a memória do emulador, e um snapshot ainda mapeado ganha uma cópia própria.
+void imageUnmap(uint16_t* memory) {
+	if (!image.memory) return;
+
+	size_t bytes = image.words * sizeof(uint16_t);
+	memcpy(memory, image.memory, bytes);
+	if (emulator.memory == image.memory) emulator.memory = memory;
+
+#if !defined(_WIN32)
+	if (image.snapshot) {
+		if (emulator.snapshot == image.snapshot) {
+			emulator.snapshot = (uint16_t*)malloc(bytes);
+			memcpy(emulator.snapshot, image.snapshot, bytes);
 		}
+
+		munmap((uint8_t*)image.memory - IMAGE_HEADER_SIZE, image.size);
+		munmap((uint8_t*)image.snapshot - IMAGE_HEADER_SIZE, image.size);
+		image.memory = image.snapshot = NULL;
+		return;
 	}
+#endif
 
-	// Cria um novo breakpoint
-	Breakpoint* bp = (Breakpoint*) malloc(sizeof(Breakpoint));
-	bp->address = addr;
-	bp->hits = hits;
-	vecAdd(&emulator.breakpoints, bp);
+	free(image.memory);
+	image.memory = NULL;
 }
 
-/// @brief Remove um breakpoint previamente configurado. Se o breakpoint não existe, não faz nada.
-/// @param addr O endereço do breakpoint a remover
-/// @return Um booleano se o breakpoint existia ou não 
-bool emuRemoveBreakpoint(uint16_t addr) {
-	// Faz uma busca linear no vetor de brakpoints e remove o de endereço igual
-	for (int i = 0; i < emulator.breakpoints.size; i++) {
-		Breakpoint* bp = (Breakpoint*)emulator.breakpoints.array;
-
-		if (bp->address == addr) {
-			free(bp);
-			vecRemove(&emulator.breakpoints, i);
-			return true;
-		}
+/// @brief Procura, a partir do endereço dado, a próxima palavra da memória diferente do snapshot.
+/// As palavras são comparadas em blocos de 16, como inteiros de 64 bits que o compilador pode
+/// vetorizar, e só o bloco com alguma diferença é examinado palavra a palavra.
+/// @return O endereço da palavra, ou memorySize se não há mais diferenças.
+int emuNextDifference(int from) {
+	const uint16_t* memory = emulator.memory;
+	const uint16_t* snapshot = emulator.snapshot;
+	int size = emulator.memorySize;
+	if (!snapshot) return size;
+
+	int i = from;
+	for (; i + 16 <= size; i += 16) {
+		uint64_t a[4], b[4];
+		memcpy(a, memory + i, sizeof(a));
+		memcpy(b, snapshot + i, sizeof(b));
+		if ((a[0] ^ b[0]) | (a[1] ^ b[1]) | (a[2] ^ b[2]) | (a[3] ^ b[3])) break;
 	}
 
-	return false;
+	for (; i < size; i++) {
+		if (memory[i] != snapshot[i]) return i;
+	}
+	return size;
 }
 
-/// @brief Obtém o breakpoint setado no endereço de memória especificado.
-/// @param addr O endereço de memória do emulador do breakpoint a obter.
-/// @return Um ponteiro para estrutura do breakpoint se havia um, NULL se não há breakpoint ali.
-Breakpoint* emuGetBreakpoint(uint16_t addr) {
-	// Faz uma busca linear no vetor de brakpoints e retorna se for encontrado
-	for (int i = 0; i < emulator.breakpoints.size; i++) {
-		Breakpoint* bp = (Breakpoint*)emulator.breakpoints.array[i];
-		if (bp->address == addr) {
-			return bp;
+/// @brief Escreve apenas as palavras da memória que diferem da memória inicial. No formato texto,
+/// uma linha "endereço: inicial -> final" por palavra, em hexadecimal. No binário, um cabeçalho de
+/// IMAGE_HEADER_SIZE bytes como o das imagens (magic "OACDELTA", versão, número de palavras da
+/// memória, número de registros e 4 bytes zerados), seguido de um registro por palavra com o
+/// endereço e o valor final, em 16 bits little-endian cada.
+/// @return 0, ou -1 se o arquivo não pôde ser escrito.
+int imageWriteDelta(FILE* out, bool binary) {
+	int count = 0;
+	for (int addr = emuNextDifference(0); addr < emulator.memorySize; addr = emuNextDifference(addr + 1)) {
+		count++;
+	}
+
+	// Cada linha do texto tem no máximo 19 caracteres ("105f: ffff -> ffff\n")
+	size_t capacity = binary ? IMAGE_HEADER_SIZE + count * 4 : count * 19 + 1;
+	uint8_t* data = (uint8_t*)calloc(capacity, 1);
+	uint8_t* p = data;
+
+	if (binary) {
+		memcpy(p, DELTA_MAGIC, 8);
+		imageWrite32(p + 8, DELTA_VERSION);
+		imageWrite32(p + 12, emulator.memorySize);
+		imageWrite32(p + 16, count);
+		p += IMAGE_HEADER_SIZE;
+	}
+
+	for (int addr = emuNextDifference(0); addr < emulator.memorySize; addr = emuNextDifference(addr + 1)) {
+		uint16_t value = emulator.memory[addr];
+		if (binary) {
+			p[0] = addr;
+			p[1] = addr >> 8;
+			p[2] = value;
+			p[3] = value >> 8;
+			p += 4;
+		} else {
+			p += sprintf((char*)p, "%03x: %04x -> %04x\n", addr, emulator.snapshot[addr], value);
 		}
 	}
 
-	return NULL;
+	bool ok = out && fwrite(data, 1, p - data, out) == (size_t)(p - data);
+	if (out && fclose(out) != 0) ok = false;
+	free(data);
+
+	if (!ok) {
+		fprintf(stderr, "Could not write the memory delta.\n");
+		return -1;
+	}
+	return 0;
 }
 
-// Verifica se um enderço se memória está dentro dos limites possíveis do tamanho da memória
-// do emulador. Se o endereço estiver fora do limite, causa uma falha e retorna true.
-bool emuGuardAddress(uint16_t addr) {
-	if (addr >= emulator.memorySize) {
-		uint32_t PC = emulator.registers->PC;
+// -- Expressões de breakpoints condicionais e tracepoints
+//
+// As expressões são compiladas uma única vez, quando o breakpoint é configurado, por um parser
+// descendente recursivo com a precedência de C. O resultado é um bytecode de pilha avaliado por
+// exprEvaluate a cada vez que a execução chega no endereço.
 
-		emuFault("Memory access out of bounds 0x%04X at 0x%03X", addr, PC);
-		return true;
-	}
+/// @brief Estado do parser de expressões
+typedef struct {
+	const char* p;
+	Expr* expr;
+	int depth;
+	const char* error;
+} ExprParser;
+
+// Operandos nomeados das expressões: registradores e flags da PSW
+static const struct { const char* name; uint8_t op; int32_t operand; } EXPR_NAMES[] = {
+	{ "A",   EXPR_REG,  offsetof(Registers, A) },
+	{ "B",   EXPR_REG,  offsetof(Registers, B) },
+	{ "C",   EXPR_REG,  offsetof(Registers, C) },
+	{ "D",   EXPR_REG,  offsetof(Registers, D) },
+	{ "R",   EXPR_REG,  offsetof(Registers, R) },
+	{ "PC",  EXPR_REG,  offsetof(Registers, PC) },
+	{ "RI",  EXPR_REG,  offsetof(Registers, RI) },
+	{ "PSW", EXPR_REG,  offsetof(Registers, PSW) },
+	{ "OV",  EXPR_FLAG, 15 },
+	{ "UN",  EXPR_FLAG, 14 },
+	{ "LE",  EXPR_FLAG, 13 },
+	{ "EQ",  EXPR_FLAG, 12 },
+	{ "GR",  EXPR_FLAG, 11 },
+	{ "HITS", EXPR_HITS, 0 },
+};
 
-	return false;
+// Operadores binários por nível de precedência, do menos para o mais prioritário. Em cada nível, os
+// operadores mais longos vêm antes dos seus prefixos.
+static const struct { const char* token; uint8_t op; } EXPR_BINARY[][6] = {
+	{ { "||", EXPR_LOR } },
+	{ { "&&", EXPR_LAND } },
+	{ { "|", EXPR_BOR } },
+	{ { "^", EXPR_BXOR } },
+	{ { "&", EXPR_BAND } },
+	{ { "==", EXPR_EQ }, { "!=", EXPR_NE } },
+	{ { "<=", EXPR_LE }, { ">=", EXPR_GE }, { "<", EXPR_LT }, { ">", EXPR_GT } },
+	{ { "+", EXPR_ADD }, { "-", EXPR_SUB } },
+};
+
+#define EXPR_LEVELS ((int)(sizeof(EXPR_BINARY) / sizeof(EXPR_BINARY[0])))
+
+static void exprParseLevel(ExprParser* parser, int level);
+
+// Adiciona uma operação ao bytecode, acompanhando a profundidade da pilha
+static void exprEmit(ExprParser* parser, uint8_t op, int32_t operand, int stackEffect) {
+	Expr* expr = parser->expr;
+	expr->code = (ExprOp*)realloc(expr->code, (expr->length + 1) * sizeof(ExprOp));
+	expr->code[expr->length++] = (ExprOp){ op, operand };
+
+	parser->depth += stackEffect;
+	if (parser->depth > EXPR_MAX_DEPTH && !parser->error) parser->error = "expression too deep";
 }
 
-// Lança uma falha de CPU por tentar executar uma instrução mal formulada ou que não existe
-void emuBadInstruction() {
-	uint32_t RI = emulator.registers->RI;
-	uint32_t PC = emulator.registers->PC;
-	emuFault("Bad instruction 0x%04X at 0x%03X", RI, PC);
+static void exprSkipSpaces(ExprParser* parser) {
+	while (*parser->p == ' ' || *parser->p == '\t') parser->p++;
 }
 
-// Lança uma falha de CPU com a mensagem formata desejada
-void emuFault(const char* fmt, ...) {
-	va_list args;
-	va_start(args, fmt);
+// Consome o token dado se ele for o próximo da entrada. Um operador não casa com o prefixo de um
+// operador mais longo (como "&" em "&&"), verificado pela ordem das tabelas.
+static bool exprAccept(ExprParser* parser, const char* token) {
+	exprSkipSpaces(parser);
+	size_t length = strlen(token);
+	if (strncmp(parser->p, token, length) != 0) return false;
 
-	// Imprime a mensagem de CPU FAULT no terminal
-	StringBuffer sb;
-	stbInit(&sb);
-	stbAppend(&sb, TERM_BOLD_RED TERM_BOLD_RED "[ERR!] CPU FAULT: " TERM_RESET);
-	stbAppendv(&sb, fmt, args);
-	stbAppend(&sb, "\n");
-	printf("%s\n", sb.array);
-	stbFree(&sb);
+	// "|" e "&" não podem consumir metade de "||" e "&&"
+	if (length == 1 && (token[0] == '|' || token[0] == '&') && parser->p[1] == token[0]) return false;
 
-	// Coloca o emulador em modo step-through e interrompe qualquer sequência de steps se havia
-	// alguma antes
-	if (emulator.breakOnFaults) {
-		emulator.breaking = true;
-		emulator.stepsLeft = 0;
+	parser->p += length;
+	return true;
+}
+
+// Operando: número, nome, [endereço] ou (expressão), precedido de operadores unários
+static void exprParseUnary(ExprParser* parser) {
+	if (parser->error) return;
+
+	if (exprAccept(parser, "!")) {
+		exprParseUnary(parser);
+		exprEmit(parser, EXPR_NOT, 0, 0);
+		return;
+	}
+	if (exprAccept(parser, "~")) {
+		exprParseUnary(parser);
+		exprEmit(parser, EXPR_BNOT, 0, 0);
+		return;
+	}
+	if (exprAccept(parser, "-")) {
+		exprParseUnary(parser);
+		exprEmit(parser, EXPR_NEG, 0, 0);
+		return;
 	}
 
-	va_end(args);
-}
+	if (exprAccept(parser, "(")) {
+		exprParseLevel(parser, 0);
+		if (!exprAccept(parser, ")") && !parser->error) parser->error = "missing ')'";
+		return;
+	}
 
-// Imprime no console um warning
-void emuWarn(const char* fmt, ...) {
-	va_list args;
-	va_start(args, fmt);
+	if (exprAccept(parser, "[")) {
+		exprParseLevel(parser, 0);
+		if (!exprAccept(parser, "]") && !parser->error) parser->error = "missing ']'";
+		exprEmit(parser, EXPR_MEM, 0, 0);
+		return;
+	}
 
-	StringBuffer sb;
-	stbInit(&sb);
+	const char* p = parser->p;
+	if (isdigit((unsigned char)*p)) {
+		char* end;
+		long value = strtol(p, &end, 0);
+		parser->p = end;
+		exprEmit(parser, EXPR_CONST, (int32_t)value, 1);
+		return;
+	}
 
-	stbAppend(&sb, TERM_BOLD_YELLOW "[WRN!] " TERM_RESET);
-	stbAppendv(&sb, fmt, args);
-	
-	printf("%s\n\n", sb.array);
-	stbFree(&sb);
+	if (isalpha((unsigned char)*p)) {
+		char name[8] = { 0 };
+		int length = 0;
+		while (isalnum((unsigned char)p[length])) {
+			if (length < (int)sizeof(name) - 1) name[length] = toupper((unsigned char)p[length]);
+			length++;
+		}
+		parser->p += length;
+
+		for (int i = 0; i < sizeof(EXPR_NAMES) / sizeof(EXPR_NAMES[0]); i++) {
+			if (length < sizeof(name) && strEquals(name, EXPR_NAMES[i].name)) {
+				uint8_t op = EXPR_NAMES[i].op;
+				if (op == EXPR_FLAG || (op == EXPR_REG && EXPR_NAMES[i].operand == offsetof(Registers, PSW))) {
+					parser->expr->readsFlags = true;
+				}
+				exprEmit(parser, op, EXPR_NAMES[i].operand, 1);
+				return;
+			}
+		}
 
-	va_end(args);
-}
+		parser->error = "unknown name";
+		return;
+	}
 
-// Imprime no terminal o conteúdo de todos os registradores da CPU emulada
-void emuDumpRegisters() {
-	Registers* regs = emulator.registers;
-	printf("---- Program registers ----\n");
-	uint16_t psw = regs->PSW;
-	printf("PC:  0x%04hx\n", regs->PC);
-	printf("RI:  0x%04hx\n", regs->RI);
-	printf("PSW: 0x%04hx\n", regs->PSW);
-	printf("  OV=%i UN=%i ", (int)getBit(psw, 15), (int)getBit(psw, 14));
-	printf("LE=%i EQ=%i GR=%i\n", (int)getBit(psw, 13), (int)getBit(psw, 12), (int)getBit(psw, 11));
-	printf("R:   0x%04hx\n", regs->R);
-	printf("\n");
-	printf("A:   0x%04hx\n", regs->A);
-	printf("B:   0x%04hx\n", regs->B);
-	printf("C:   0x%04hx\n", regs->C);
-	printf("D:   0x%04hx\n", regs->D);	
+	parser->error = *p ? "unexpected character" : "unexpected end of expression";
 }
 
-// Handler de SIGINT (interrupção pelo CTRL-C)
-void signIntHandler(int sign) {
-	static bool interruptedBefore = false;
-
-	// Remove all console colors
-	printf(TERM_RESET " ");
+// Operadores binários associativos à esquerda do nível de precedência dado em diante
+static void exprParseLevel(ExprParser* parser, int level) {
+	if (level == EXPR_LEVELS) {
+		exprParseUnary(parser);
+		return;
+	}
 
-	// Retransmit signal
-	signal(sign, SIG_IGN);
+	exprParseLevel(parser, level + 1);
+	while (!parser->error) {
+		int i = 0;
+		while (i < 6 && EXPR_BINARY[level][i].token && !exprAccept(parser, EXPR_BINARY[level][i].token)) i++;
+		if (i == 6 || !EXPR_BINARY[level][i].token) break;
 
-	// If ctrl-c was pressed before and within a certain time threshold, exit the application
-	if (difftime(time(NULL), lastInterruptBreak) < 1.5 && interruptedBefore) {
-		exit(0);
+		exprParseLevel(parser, level + 1);
+		exprEmit(parser, EXPR_BINARY[level][i].op, 0, -1);
 	}
+}
 
-	// Save last time ctrl-c was pressed
-	interruptedBefore = true;
-	time(&lastInterruptBreak);
+/// @brief Compila o texto de uma expressão para bytecode.
+/// @return NULL em caso de sucesso ou uma mensagem descrevendo o erro.
+const char* exprCompile(const char* text, Expr* expr) {
+	*expr = (Expr){ NULL, 0, false };
+	ExprParser parser = { text, expr, 0, NULL };
 
-	printf("\n-- Ctrl-C pressed. Breaking execution.\n");
+	exprParseLevel(&parser, 0);
+	exprSkipSpaces(&parser);
+	if (!parser.error && *parser.p) parser.error = "unexpected character";
 
-	// Put the emulator in breaking mode
-	emulator.stepsLeft = 0;
-	emulator.breaking = true;
+	if (parser.error) exprFree(expr);
+	return parser.error;
+}
 
-	// Reset signal handler
-	signal(SIGINT, signIntHandler);
+/// @brief Avalia uma expressão compilada. Uma expressão vazia é sempre verdadeira (1).
+/// @param hits Valor de HITS na expressão
+int32_t exprEvaluate(const Expr* expr, uint32_t hits) {
+	if (expr->length == 0) return 1;
+	if (expr->readsFlags) emuSyncFlags();
+
+	const uint8_t* regs = (const uint8_t*)emulator.registers;
+	int32_t stack[EXPR_MAX_DEPTH];
+	int top = -1;
+
+	for (int i = 0; i < expr->length; i++) {
+		const ExprOp* op = &expr->code[i];
+		int32_t b = top >= 1 ? stack[top] : 0;
+
+		switch (op->op) {
+		case EXPR_CONST: stack[++top] = op->operand; break;
+		case EXPR_REG:   stack[++top] = *(const uint16_t*)(regs + op->operand); break;
+		case EXPR_FLAG:  stack[++top] = (emulator.registers->PSW >> op->operand) & 1; break;
+		case EXPR_HITS:  stack[++top] = (int32_t)hits; break;
+
+		// Endereços fora da memória são lidos como 0
+		case EXPR_MEM: {
+			uint32_t address = (uint32_t)stack[top];
+			stack[top] = address < emulator.memorySize ? emulator.memory[address] : 0;
+			break;
+		}
+
+		case EXPR_NOT:  stack[top] = !stack[top]; break;
+		case EXPR_BNOT: stack[top] = ~stack[top] & 0xFFFF; break;
+		case EXPR_NEG:  stack[top] = -stack[top]; break;
+
+		case EXPR_ADD:  stack[--top] += b; break;
+		case EXPR_SUB:  stack[--top] -= b; break;
+		case EXPR_BAND: stack[--top] &= b; break;
+		case EXPR_BOR:  stack[--top] |= b; break;
+		case EXPR_BXOR: stack[--top] ^= b; break;
+		case EXPR_EQ:   top--; stack[top] = stack[top] == b; break;
+		case EXPR_NE:   top--; stack[top] = stack[top] != b; break;
+		case EXPR_LT:   top--; stack[top] = stack[top] < b; break;
+		case EXPR_LE:   top--; stack[top] = stack[top] <= b; break;
+		case EXPR_GT:   top--; stack[top] = stack[top] > b; break;
+		case EXPR_GE:   top--; stack[top] = stack[top] >= b; break;
+		case EXPR_LAND: top--; stack[top] = stack[top] && b; break;
+		case EXPR_LOR:  top--; stack[top] = stack[top] || b; break;
+		}
+	}
+
+	return stack[0];
+}
+
+/// @brief Libera o bytecode de uma expressão
+void exprFree(Expr* expr) {
+	free(expr->code);
+	*expr = (Expr){ NULL, 0, false };
 }
 
 // -- Funções de manipulação de StringBuffer --
@@ -1439,6 +5980,17 @@ bool getBit(uint16_t value, int bit) {
 	return (value >> bit) & 1UL;
 }
 
+/// @brief Obtém o tempo atual em segundos de um relógio monotônico. Usado para medir intervalos.
+double getTimeSeconds() {
+	#ifdef _WIN32
+	return (double)clock() / CLOCKS_PER_SEC;
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+	#endif
+}
+
 /// @brief Converte toda uma string para minúsculo
 void toLowerCase(char* str) {
 	while (*str) {
@@ -1452,56 +6004,6 @@ bool strEquals(const char* a, const char* b) {
 	return strcmp(a, b) == 0;
 }
 
-/// @brief Inicializa um vetor dinâmico
-/// @param vec O próprio vetor a ser inicializado
-void vecInit(Vector* vec) {
-	vec->array = (void**) malloc(sizeof(void*));
-	vec->capacity = 1;
-	vec->size = 0;
-}
-
-/// @brief Libera a memória ocupada por um vetor dinâmico e libera todos os ponteiros contidos.
-void vecFree(Vector* vec) {
-	for (int i = 0; i < vec->size; i++) {
-		free(vec->array[i]);
-	}
-	free(vec->array);
-	
-	vec->array = NULL;
-	vec->capacity = -1;
-	vec->size = -1;
-}
-
-/// @brief Cresce a capacidade do vetor
-void vecGrow(Vector* vec) {
-	vec->capacity *= 2;
-	vec->array = realloc(vec->array, sizeof(void*) * vec->capacity);
-}
-
-/// @brief Adiciona um elemento no vetor
-void vecAdd(Vector* vec, void* elem) {
-	if (vec->capacity == vec->size) {
-		vecGrow(vec);
-	}
-
-	vec->array[vec->size] = elem;
-	vec->size++;
-}
-
-/// @brief Remove um um elemento pelo seu índice
-/// @param index O índice do elemento a ser removido 
-void vecRemove(Vector* vec, int index) {
-	// Assegura a validade do índice
-	assert(index < vec->size);
-
-	// Shift all elements to the left by one position
-	for (int i = index; i < vec->size - 1; i++) {
-		vec->array[i] = vec->array[i + 1];
-	}
-
-	vec->size--;
-}
-
 /// @brief Imprime uma string formatada no console utilizando § para as cores estilizadas.
 void prints(const char* fmt, ...) {
 	va_list args;
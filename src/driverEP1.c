@@ -27,71 +27,244 @@ int nchar;
 unsigned short int M[MAXMEMSIZE];  // unsigned 16-bit
 int memSize;
 
+// Lê todo o conteúdo do arquivo para um bloco alocado, em leituras grandes. Funciona também com
+// pipes, onde o tamanho não é conhecido antes.
+static char *leArquivo (FILE *fp, size_t *size) {
+  size_t capacity=1<<16, used=0;
+  char *data=malloc (capacity+1);
+  while (data) {
+    used+=fread (data+used, 1, capacity-used, fp);
+    if (used<capacity) break;
+    capacity*=2;
+    char *grown=realloc (data, capacity+1);
+    if (!grown) free (data);
+    data=grown;
+  }
+  if (!data) return NULL;
+  data[used]='\0';
+  *size=used;
+  return data;
+}
+
+static int erroDeSintaxe (int lineNumber, const char *token) {
+  int length=0;
+  while (token[length] && !isspace ((unsigned char)token[length])) length++;
+  printf ("syntax error reading line %d.\n", lineNumber);
+  printf ("last token read %.*s.\n", length, token);
+  printf ("last memory address read %x.\n", memSize);
+  puts ("exiting read.");
+  return -1;
+}
+
+// Valor de um dígito hexadecimal, ou -1
+static int valorHex (char c) {
+  if (c>='0' && c<='9') return c-'0';
+  if (c>='a' && c<='f') return c-'a'+10;
+  if (c>='A' && c<='F') return c-'A'+10;
+  return -1;
+}
+
+// Lê o arquivo inteiro e o decodifica em uma única passada. Cada token é um valor hexadecimal ou
+// uma repetição N*valor, com N decimal, expandida de uma vez. Imagens vazias ou maiores que
+// MAXMEMSIZE palavras são rejeitadas.
 int leMem (FILE *fpIn){
   memSize=0;
-  int lineNumber=1;
-  fgets (bufferDeLinha, MAXNCHAR, fpIn);
-  if (strncmp (bufferDeLinha, HEADER, 8)) {
+  if (!fpIn) {
+    puts ("Could not open the memory file, exiting read.");
+    return -1;
+  }
+
+  size_t size;
+  char *data=leArquivo (fpIn, &size);
+  fclose (fpIn);
+  if (!data) {
+    puts ("Could not read the memory file, exiting read.");
+    return -1;
+  }
+
+  if (strncmp (data, HEADER, 8)) {
 	// strcmp returns zero (false) if strings are equal
 	puts ("Logisim RAM file header not found, exiting read.");
-	printf ("line read: %s\n", bufferDeLinha);
+	printf ("line read: %.*s\n", (int)strcspn (data, "\r\n"), data);
+	free (data);
 	return -1;
   }
-  while (!feof(fpIn)) {
-    fgets (bufferDeLinha, MAXNCHAR, fpIn);
-    lineNumber++;
-    char *token;
-    int rep, val;
-    token=strtok (bufferDeLinha, " \n\t");
-    while (token) {
-		// puts (token);
-		if (sscanf (token, "%d*%x", &rep, &val)==2) {
-		  for (int i=0;i<rep;i++) {
-			M[memSize]=val;
-			memSize++;
-		  }
-		} else {
-		  if (sscanf(token, "%x", &val)==1) {
-			M[memSize]=val;
-			memSize++;
-          } else {
-		    printf ("syntax error reading line %d.\n", lineNumber);
-		    printf ("last token read %s.\n", token);
-		    printf ("last memory address read %x.\n", memSize);
-		    puts ("exiting read.");
-		    return -1;
-		} 
-	  }
-      token=strtok (NULL, " \n\t");
-	} // while token
+
+  // O resto da linha do cabeçalho é ignorado
+  int lineNumber=1;
+  const char *p=data+8;
+  while (*p!='\0' && *p!='\n') p++;
+
+  int result=0;
+  while (*p) {
+    // Espaços entre os tokens
+    if (*p=='\n') lineNumber++;
+    if (isspace ((unsigned char)*p)) {
+      p++;
+      continue;
+    }
+
+    // Lê os dígitos do token como hexadecimal e, para o caso de ser o N de uma repetição, decimal
+    const char *token=p;
+    unsigned long hex=0, dec=0;
+    bool decimal=true;
+    int digit;
+    while ((digit=valorHex (*p))>=0) {
+      if (digit>9) decimal=false;
+      if (hex<=0xFFFFFFFF) hex=hex*16+digit;
+      if (dec<=0xFFFFFFFF) dec=dec*10+digit;
+      p++;
+    }
+
+    unsigned long rep=1, val=hex;
+    if (*p=='*' && p>token && decimal) {
+      // Repetição N*valor
+      rep=dec;
+      const char *value=++p;
+      val=0;
+      while ((digit=valorHex (*p))>=0) {
+        if (val<=0xFFFFFFFF) val=val*16+digit;
+        p++;
+      }
+      if (p==value) {
+        result=erroDeSintaxe (lineNumber, token);
+        break;
+      }
+    }
+
+    if (p==token || (*p && !isspace ((unsigned char)*p))) {
+      result=erroDeSintaxe (lineNumber, token);
+      break;
+    }
+
+    if (rep>(unsigned long)(MAXMEMSIZE-memSize)) {
+      printf ("memory image too large at line %d: more than %d words.\n", lineNumber, MAXMEMSIZE);
+      puts ("exiting read.");
+      result=-1;
+      break;
+    }
+
+    // Expande a repetição de uma vez: zeros com memset, outros valores dobrando o trecho já escrito
+    unsigned short int *dst=&M[memSize];
+    if (val==0) {
+      memset (dst, 0, rep*sizeof(*dst));
+    } else if (rep>0) {
+      dst[0]=(unsigned short int)val;
+      for (unsigned long filled=1; filled<rep; ) {
+        unsigned long chunk=(filled<rep-filled) ? filled : rep-filled;
+        memcpy (dst+filled, dst, chunk*sizeof(*dst));
+        filled+=chunk;
+      }
+    }
+    memSize+=rep;
+  }
+
+  if (result==0 && memSize==0) {
+    puts ("memory image is empty.");
+    puts ("exiting read.");
+    result=-1;
   }
-  fclose (fpIn);
-  return 0;
+
+  free (data);
+  return result;
+}
+
+// Escreve um valor em hexadecimal minúsculo, sem zeros à esquerda, e devolve o número de caracteres
+static int escreveHex (char *p, unsigned short int valor) {
+  static const char digitos[]="0123456789abcdef";
+  int n=(valor>0xFFF) ? 4 : (valor>0xFF) ? 3 : (valor>0xF) ? 2 : 1;
+  for (int i=n-1;i>=0;i--) {
+    p[i]=digitos[valor&0xF];
+    valor>>=4;
+  }
+  return n;
 }
 
+// Escreve a memória como o próprio Logisim: 8 tokens por linha e repetições de 4 ou mais palavras
+// iguais como N*valor. O texto é montado em um único bloco e gravado com um só fwrite.
 int escreveMem (FILE *fpOut) {
-  fputs (HEADER, fpOut);
-  for (int i=0;i<memSize;i++) {
-	if ((i%8)==0) fputc('\n', fpOut);
-	else if ((i%4)==0) fputc('\t', fpOut);
-    fprintf (fpOut, "%hx ", M[i]);
+  // O maior token, "4192*ffff", tem 9 caracteres mais o separador
+  char *texto=malloc (sizeof(HEADER)+memSize*10);
+  if (!texto) return -1;
+  char *p=texto;
+  memcpy (p, HEADER, sizeof(HEADER)-1);
+  p+=sizeof(HEADER)-1;
+
+  int tokens=0;
+  for (int i=0;i<memSize;) {
+    int rep=1;
+    while (i+rep<memSize && M[i+rep]==M[i]) rep++;
+
+    for (int n=(rep>=4) ? 1 : rep; n>0; n--) {
+      *p++=((tokens++%8)==0) ? '\n' : ' ';
+      if (rep>=4) p+=sprintf (p, "%d*", rep);
+      p+=escreveHex (p, M[i]);
+    }
+    i+=rep;
   }
+
+  fwrite (texto, 1, p-texto, fpOut);
+  free (texto);
   return 0;
 }
 
 int main (int argc, char *argv[]) {
+  // Remove as opções do emulador (ex: --headless), deixando apenas os arquivos
+  argc=cliParseArgs (argc, argv);
   if ((argc==2)||(argc==3)) {
-    FILE *fpIn=fopen (argv[1], "rt");
-    leMem(fpIn);
-    processa (M, memSize);
-    if (argc==2) escreveMem(stdout);
-    else {
-      FILE *fpOut=fopen (argv[2], "wt");
-      escreveMem(fpOut);
+    // Imagens binárias são mapeadas pelo emulador; os demais arquivos são lidos no formato do Logisim
+    unsigned short int *memoria=M;
+    int binaria=imageLoad (argv[1], &memoria, &memSize);
+    if (binaria<0) return 1;
+    if (!binaria) {
+      FILE *fpIn=fopen (argv[1], "rt");
+      if (leMem(fpIn)) return 1;
+    }
+    // Sem execução (ex: --aot) não há memória a escrever
+    int result=processa (memoria, memSize);
+    if (result==PROCESSA_NO_OUTPUT) return 0;
+    // A saída pode sobrescrever o próprio arquivo mapeado, então a memória final é copiada antes
+    if (memoria!=M) imageUnmap (M);
+    int formato=cliDumpFormat ();
+    bool binario=(formato==DUMP_BINARY || formato==DUMP_DELTA_BINARY);
+    FILE *fpOut=stdout;
+    if (argc==3) fpOut=fopen (argv[2], binario ? "wb" : "wt");
+    if (!fpOut) {
+      printf ("Could not open '%s' for writing.\n", argv[2]);
+      return 1;
     }
+    int escrita=0;
+    if (formato==DUMP_BINARY) escrita=imageWrite (fpOut, M, memSize);
+    else if (formato==DUMP_DELTA || formato==DUMP_DELTA_BINARY)
+      escrita=imageWriteDelta (fpOut, binario);
+    else escreveMem(fpOut);
+    // Em pipelines, uma imagem que não pôde ser escrita precisa aparecer no código de saída
+    if (escrita<0) return 1;
+    // Programas interrompidos pelo detector de laços terminam com um código distinto
+    if (result==PROCESSA_NON_TERMINATING) return 2;
   } else {
      puts ("Read and write files containing logisim RAM content.");
-     puts ("Usage: ./a.out <input filename> [output filename]");
+     puts ("Usage: ./a.out [options] <input filename> [output filename]");
+     puts ("Options:");
+     puts ("  -H, --headless   run without tracing or debugger, report only the final state");
+     puts ("  --core=<switch|threaded|jit>  interpreter core used while running freely");
+     puts ("  --detect-loops   stop headless runs that repeat a machine state (exit code 2)");
+     puts ("  --no-fusion      do not fuse common instruction sequences into superinstructions");
+     puts ("  --aot=<file.c>   translate the program to a standalone C file instead of running it");
+     puts ("  --dump=<text|binary|delta|delta-binary>  format of the output memory file");
+     puts ("  --convert        write the input image in the other format without running it");
+     puts ("  --dummy          disable all interactive features");
+     puts ("  --no-trace       do not print each instruction while running freely");
+     puts ("  --no-break-at-start, --no-break-at-faults, --no-break-at-halt  debugger stop points");
+     puts ("  --allow-wrap     only warn when the program counter wraps around");
+     puts ("  --journal[=<n>]  keep the last n instructions for the back and reverse-continue commands");
+     puts ("  --resume=<file>  continue from a state saved by the save command");
+     puts ("  --record=<file>  write every executed instruction to a binary trace (see emul-trace)");
+     puts ("  --ui-thread=<block|drop|off>  print trace and messages from a separate thread");
+     puts ("  --shm=<name>     publish registers and memory in a POSIX shared memory segment");
+     puts ("  --shm-interval=<n>  instructions between shared memory updates");
+     puts ("  -x <script>      run the debugger commands in the script file before reading stdin");
+     puts ("  -e \"<commands>\" run a ';'-separated list of debugger commands after the script");
   }
   return 0;
 }
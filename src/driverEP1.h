@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
 
 #define MAXNCHAR 1024
 #define MAXMEMSIZE 4192
@@ -7,4 +10,26 @@
 
 int leMem (FILE *fpIn);
 int escreveMem (FILE *fpOut);
+// Resultados de processa
+#define PROCESSA_OK 0
+#define PROCESSA_NO_OUTPUT 1
+#define PROCESSA_NON_TERMINATING 2
+
 int processa (short int *M, int memsize);
+int cliParseArgs (int argc, char *argv[]);
+
+// Formatos do arquivo de saída (opções --dump e --convert). Os formatos delta têm apenas as palavras
+// diferentes da memória inicial.
+#define DUMP_TEXT 0
+#define DUMP_BINARY 1
+#define DUMP_DELTA 2
+#define DUMP_DELTA_BINARY 3
+
+int cliDumpFormat (void);
+
+// Imagens binárias de memória. imageLoad devolve 1 se o arquivo é uma imagem binária, já mapeada em
+// *memory, 0 se não é (e deve ser lido por leMem) e -1 em caso de erro.
+int imageLoad (const char *path, unsigned short int **memory, int *memsize);
+int imageWrite (FILE *fpOut, const unsigned short int *memory, int memsize);
+int imageWriteDelta (FILE *fpOut, bool binary);
+void imageUnmap (unsigned short int *memory);
@@ -0,0 +1,220 @@
+/**
+ * emul-trace: decodificador dos traces binários gravados pelo emulador com a opção --record.
+ *
+ * Reconstrói PC e PSW de cada registro a partir das diferenças gravadas, filtra por janela de
+ * números de instrução, faixa de endereços e opcode, e imprime cada instrução desmontada com o valor
+ * que ela escreveu:
+ *   emul-trace [--from=<n>] [--to=<n>] [--range=<início>-<fim>] [--op=<mnemônico>] <trace>
+ **/
+
+#include "emulTrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <strings.h>
+
+// Número de registros lidos do arquivo de cada vez
+#define READ_BLOCK_RECORDS (1 << 16)
+
+// Opcodes que alteram algo além do PC
+#define OPCODE_LDA  0x1
+#define OPCODE_STA  0x2
+#define OPCODE_JMP  0x3
+#define OPCODE_JNZ  0x4
+#define OPCODE_RET  0x5
+#define OPCODE_ARIT 0x6
+
+// Tabela com o nome das intruções para cada opcode, como no emulador
+static const char* const INSTRUCTION_NAMES[] = {
+	"NOP", "LDA", "STA", "JMP", "JNZ", "RET", "ARIT", "???",
+	"???", "???", "???", "???", "???", "???", "???", "HLT"
+};
+
+// Nome dos registradores
+static const char* const REGISTER_NAMES[] = {
+	"A", "B", "C", "D", "?", "?", "R", "PSW"
+};
+
+// Formato das operações aritméticas na notação extendida do emulador
+static const char* const ARIT_EXT_FMT[] = {
+	"%s = 0",
+	"%s = FFFF",
+	"%s = ~%s",
+	"%s = %s & %s",
+	"%s = %s | %s",
+	"%s = %s ^ %s",
+	"%s = %s + %s",
+	"%s = %s - %s"
+};
+
+/// @brief Filtros da linha de comando. Um registro é impresso se passa por todos.
+typedef struct {
+	uint64_t from, to;
+	uint16_t low, high;
+	int opcode;
+} Filter;
+
+/// @brief Desmonta uma instrução na notação extendida do emulador, sem cores
+static void disassemble(uint16_t instruction, char* out, size_t size) {
+	uint8_t opcode = (instruction & 0xF000) >> 12;
+	uint16_t argument = (instruction & 0x0FFF);
+	const char* name = INSTRUCTION_NAMES[opcode];
+
+	switch (opcode) {
+	case OPCODE_LDA:
+	case OPCODE_STA:
+		snprintf(out, size, "%s [%Xh]", name, argument);
+		break;
+	case OPCODE_JMP:
+	case OPCODE_JNZ:
+		snprintf(out, size, "%s %Xh", name, argument);
+		break;
+	case OPCODE_ARIT: {
+		uint8_t bitsOpr = (argument & 0b111000000000) >> 9;
+		uint8_t bitsDst = (argument & 0b000111000000) >> 6;
+		uint8_t bitsOp1 = (argument & 0b000000111000) >> 3;
+		uint8_t bitsOp2 =  argument & 0b000000000111;
+		bool op2zero = (bitsOp2 & 0b100) == 0;
+
+		int length = snprintf(out, size, "%s ", name);
+		snprintf(out + length, size - length, ARIT_EXT_FMT[bitsOpr], REGISTER_NAMES[bitsDst],
+			REGISTER_NAMES[bitsOp1], op2zero ? "0" : REGISTER_NAMES[bitsOp2 & 0b011]);
+		break;
+	}
+	default:
+		snprintf(out, size, "%s", name);
+		break;
+	}
+}
+
+/// @brief Imprime um registro já decodificado
+static void printRecord(uint64_t number, uint16_t pc, const TraceRecord* record, uint16_t psw) {
+	char text[32], written[16] = "";
+	disassemble(record->ri, text, sizeof(text));
+
+	// O que a instrução escreveu, se ela não falhou
+	uint8_t opcode = (record->ri & 0xF000) >> 12;
+	bool fault = record->pc & TRACE_FAULT;
+	if (!fault) {
+		switch (opcode) {
+		case OPCODE_LDA:
+			snprintf(written, sizeof(written), "A=%04X", record->value);
+			break;
+		case OPCODE_STA:
+			snprintf(written, sizeof(written), "[%03X]=%04X", record->ri & 0x0FFF, record->value);
+			break;
+		case OPCODE_JMP:
+		case OPCODE_JNZ:
+		case OPCODE_RET:
+			snprintf(written, sizeof(written), "R=%04X", record->value);
+			break;
+		case OPCODE_ARIT:
+			snprintf(written, sizeof(written), "%s=%04X", REGISTER_NAMES[(record->ri & 0x01C0) >> 6],
+				record->value);
+			break;
+		}
+	}
+
+	printf("#%-10llu %03X: %04X  %-18s %-11s PSW=%04X%s\n", (unsigned long long)number, pc,
+		record->ri, text, written, psw, fault ? "  FAULT" : "");
+}
+
+/// @brief Lê o opcode do filtro --op, pelo mnemônico ou pelo dígito hexadecimal
+/// @return O opcode, ou -1 se não é válido.
+static int parseOpcode(const char* text) {
+	for (int i = 0; i < 16; i++) {
+		if (strcmp(INSTRUCTION_NAMES[i], "???") != 0 && strcasecmp(text, INSTRUCTION_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+
+	char* end;
+	long value = strtol(text, &end, 16);
+	return (*text && !*end && value >= 0 && value < 16) ? (int)value : -1;
+}
+
+static void printUsage() {
+	puts("Decodes a binary trace recorded by emul --record=<file>.");
+	puts("Usage: emul-trace [options] <trace file>");
+	puts("Options:");
+	puts("  --from=<n>, --to=<n>    only instructions numbered from n and up to n");
+	puts("  --range=<start>-<end>   only instructions at hexadecimal addresses in the range");
+	puts("  --op=<mnemonic>         only instructions with the opcode (e.g. STA, ARIT or 2)");
+}
+
+int main(int argc, char* argv[]) {
+	Filter filter = { .from = 0, .to = UINT64_MAX, .low = 0, .high = 0xFFFF, .opcode = -1 };
+	const char* path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		char* arg = argv[i];
+		unsigned int low, high;
+
+		if (arg[0] != '-' && !path) {
+			path = arg;
+		} else if (strncmp(arg, "--from=", 7) == 0) {
+			filter.from = strtoull(arg + 7, NULL, 10);
+		} else if (strncmp(arg, "--to=", 5) == 0) {
+			filter.to = strtoull(arg + 5, NULL, 10);
+		} else if (strncmp(arg, "--range=", 8) == 0 && sscanf(arg + 8, "%x-%x", &low, &high) == 2) {
+			filter.low = low;
+			filter.high = high;
+		} else if (strncmp(arg, "--op=", 5) == 0 && (filter.opcode = parseOpcode(arg + 5)) >= 0) {
+			continue;
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (!path) {
+		printUsage();
+		return 1;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open '%s'.\n", path);
+		return 1;
+	}
+
+	TraceHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 8) != 0) {
+		fprintf(stderr, "'%s' is not an emulator trace file.\n", path);
+		fclose(file);
+		return 1;
+	}
+
+	if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+		fprintf(stderr, "Unsupported trace file version.\n");
+		fclose(file);
+		return 1;
+	}
+
+	// Os registros são lidos em blocos grandes e todos são decodificados, mesmo os filtrados, pois
+	// PC e PSW dependem do registro anterior
+	TraceRecord* records = (TraceRecord*)malloc(READ_BLOCK_RECORDS * sizeof(TraceRecord));
+	uint64_t number = header.firstInstruction;
+	uint16_t pc = 0xFFFF, psw = 0;
+	size_t count;
+
+	while ((count = fread(records, sizeof(TraceRecord), READ_BLOCK_RECORDS, file)) > 0) {
+		for (size_t i = 0; i < count; i++, number++) {
+			const TraceRecord* record = &records[i];
+			pc = (pc + 1 + record->pc) & TRACE_PC_MASK;
+			psw ^= record->psw;
+
+			if (number < filter.from || number > filter.to) continue;
+			if (pc < filter.low || pc > filter.high) continue;
+			if (filter.opcode >= 0 && (record->ri >> 12) != filter.opcode) continue;
+			printRecord(number, pc, record, psw);
+		}
+
+		if (number > filter.to) break;
+	}
+
+	free(records);
+	fclose(file);
+	return 0;
+}
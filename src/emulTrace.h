@@ -0,0 +1,42 @@
+/* emulTrace.h
+ * Formato dos traces binários gravados pelo emulador com a opção --record e lidos pela ferramenta
+ * emul-trace.
+ *
+ * O arquivo começa com um TraceHeader e segue com um TraceRecord de tamanho fixo por instrução
+ * executada, na ordem de execução. Os campos ficam na ordem de bytes da máquina que gravou o trace.
+ * PC e PSW são gravados como a diferença para o registro anterior, de forma que a maioria dos
+ * registros tem esses campos zerados:
+ *   pc     os 13 bits baixos são PC - (PC do registro anterior + 1), módulo 2^13; o primeiro
+ *          registro usa -1 como PC anterior. Os bits altos são as flags TRACE_*.
+ *   ri     a instrução executada
+ *   value  o novo valor do que a instrução alterou: A no LDA, a palavra escrita pelo STA (o
+ *          endereço é o argumento da instrução), R no JMP, JNZ e RET e o registrador destino na ARIT
+ *   psw    PSW depois da instrução, em xor com a PSW do registro anterior (0 antes do primeiro)
+ */
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "OACTRACE"
+#define TRACE_VERSION 1
+
+// Bits de TraceRecord.pc
+#define TRACE_PC_MASK 0x1FFF
+#define TRACE_FAULT   0x8000
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t memorySize;
+	uint32_t reserved;
+
+	// Número da instrução do primeiro registro (diferente de 0 ao continuar um estado salvo)
+	uint64_t firstInstruction;
+} TraceHeader;
+
+typedef struct {
+	uint16_t pc;
+	uint16_t ri;
+	uint16_t value;
+	uint16_t psw;
+} TraceRecord;